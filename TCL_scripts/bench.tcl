@@ -0,0 +1,24 @@
+############################################################
+## Benchmark of harris_top, canny, the dataflow runtime, HarrisEngine and
+## IncrementalHarris in C simulation.
+## Arguments: repeats, baseline file, tolerance in %
+## No baseline is committed, the first run records
+## Harris/testbench/bench_baseline.csv and later runs compare against it.
+############################################################
+open_project Harris_bench
+set_top harris_top
+add_files Harris/src/harris.hpp -cflags "-DHARRIS_STATS"
+add_files Harris/src/harris_ppc.hpp
+add_files Harris/src/harris_simd.hpp
+add_files Harris/src/harris_dataflow.hpp
+add_files Harris/src/harris_context.hpp
+add_files Harris/src/harris_engine.hpp
+add_files Harris/src/harris_incremental.hpp
+add_files Harris/src/top.cpp -cflags "-DHARRIS_STATS"
+add_files Harris/src/top.hpp
+add_files -tb Harris/testbench/bench.cpp -cflags "-DHARRIS_STATS -pthread"
+add_files -tb Harris/Test_pictures
+open_solution "bench"
+set_part {xc7z020-clg400-1}
+create_clock -period 10 -name default
+csim_design -O -ldflags {-pthread} -argv {5 ../../../../Harris/testbench/bench_baseline.csv 10}
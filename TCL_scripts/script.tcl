@@ -6,15 +6,22 @@
 open_project Harris
 set_top harris_top
 add_files Harris/src/harris.hpp
+add_files Harris/src/harris_ppc.hpp
+add_files Harris/src/harris_simd.hpp
+add_files Harris/src/harris_parallel.hpp
+add_files Harris/src/harris_dataflow.hpp
+add_files Harris/src/harris_context.hpp
+add_files Harris/src/harris_engine.hpp
+add_files Harris/src/harris_incremental.hpp
 add_files Harris/src/top.cpp
 add_files Harris/src/top.hpp
-add_files -tb Harris/testbench/tb.cpp
+add_files -tb Harris/testbench/tb.cpp -cflags "-pthread"
 add_files -tb Harris/Test_pictures
 open_solution "TCL_scripts"
 set_part {xc7z020-clg400-1}
 create_clock -period 10 -name default
 #source "./Harris/TCL_scripts/directives.tcl"
-csim_design -argv {150}
+csim_design -ldflags {-pthread} -argv {150}
 csynth_design
-cosim_design
+cosim_design -ldflags {-pthread}
 export_design -format ip_catalog
@@ -1,18 +1,134 @@
+#ifndef HARRIS_HPP
+#define HARRIS_HPP
+
 #include "hls_video.h"
 #include <ap_fixed.h>
 #include <stdint.h>
 #include "hls_stream.h"
-
+#if defined(HARRIS_STATS) && !defined(__SYNTHESIS__)
+#include <chrono>
+#include <mutex>
+#endif
+
+/*
+ * Largest frame of the single pixel tops, override with -DMAX_WIDTH=3840
+ * -DMAX_HEIGHT=2160 to build them for 4K.
+ */
+#ifndef MAX_WIDTH
 #define MAX_WIDTH  1920
+#endif
+#ifndef MAX_HEIGHT
 #define MAX_HEIGHT 1080
+#endif
+#define MAX_CORNERS 512
+
+/*
+ * Largest grid of the grid corner list and the corners kept per cell.
+ */
+#ifndef GRID_COLS
+#define GRID_COLS 16
+#endif
+#ifndef GRID_ROWS
+#define GRID_ROWS 9
+#endif
+#ifndef GRID_CORNERS
+#define GRID_CORNERS 4
+#endif
+
+/*
+ * Corners that may wait for the heaps of the sparse lists. A longer burst
+ * stalls the pixel loop until the heaps catch up.
+ */
+#ifndef CANDIDATE_DEPTH
+#define CANDIDATE_DEPTH 64
+#endif
+
+/*
+ * Window over which the structure tensor is summed before the response,
+ * 1 (per pixel products), 3, 5 or 7. TENSOR_GAUSSIAN selects binomial
+ * instead of box weights. The per pixel tensor has a determinant of zero,
+ * so the response needs a window to find corners.
+ */
+#ifndef TENSOR_WINDOW
+#define TENSOR_WINDOW 3
+#endif
+#ifndef TENSOR_GAUSSIAN
+#define TENSOR_GAUSSIAN 1
+#endif
+
+/*
+ * Octaves of the multi-scale detector, level 0 is the input frame.
+ */
+#ifndef PYRAMID_LEVELS
+#define PYRAMID_LEVELS 3
+#endif
+
+/*
+ * Cameras sharing one pipeline in the multi-stream mode, a power of two.
+ */
+#ifndef MULTI_STREAMS
+#define MULTI_STREAMS 4
+#endif
+
+/*
+ * Gradient magnitude of the Canny Sobel stage: the euclidean norm through
+ * hls::sqrt, |gx| + |gy| or alpha max + beta min. The last two need neither
+ * the floating point core nor a divider.
+ */
+#define CANNY_MAGNITUDE_SQRT 0
+#define CANNY_MAGNITUDE_L1 1
+#define CANNY_MAGNITUDE_ALPHA_MAX 2
+#ifndef CANNY_MAGNITUDE
+#define CANNY_MAGNITUDE CANNY_MAGNITUDE_SQRT
+#endif
+
+/*
+ * Rows a weak Canny edge waits in the hysteresis stage for a connection to a
+ * strong one
+ */
+#ifndef HYSTERESIS_ROWS
+#define HYSTERESIS_ROWS 8
+#endif
 
 
 
 namespace imgProc {
 
 typedef hls::stream<ap_axiu<32,1,1,1> > AXI_STREAM;
+typedef hls::stream<ap_axiu<32,1,8,1> > AXI_TAGGED_STREAM;
 typedef hls::Mat<MAX_HEIGHT,MAX_WIDTH,HLS_8UC3>RGB_IMAGE;
 
+/* Bits needed to hold V */
+template<unsigned long long V>
+struct bitsFor {
+	static const int value = 1 + bitsFor<(V >> 1)>::value;
+};
+template<>
+struct bitsFor<0> {
+	static const int value = 0;
+};
+
+/*
+ * Widths of the gradient -> product -> response path, derived from the gain
+ * of the Sobel kernels (the sum of their positive taps) so nothing wraps.
+ * The response is det - k*tra^2 with k = RESPONSE_K / 2^16, shifted down by
+ * RESPONSE_SHIFT.
+ */
+const int SOBEL_GAIN = 4;
+const int RESPONSE_K = 2621;
+const int RESPONSE_SHIFT = 16;
+const unsigned long long GRADIENT_MAX = SOBEL_GAIN * 255;
+const int GRADIENT_BITS = bitsFor<GRADIENT_MAX>::value + 1;
+const int SQUARE_BITS = bitsFor<GRADIENT_MAX * GRADIENT_MAX>::value;
+const int CROSS_BITS = SQUARE_BITS + 1;
+const int DET_BITS = 2 * SQUARE_BITS + 2;
+const int RESPONSE_BITS = DET_BITS - RESPONSE_SHIFT;
+
+typedef ap_int<GRADIENT_BITS> gradient_t;
+typedef ap_uint<SQUARE_BITS> square_t;
+typedef ap_int<CROSS_BITS> cross_t;
+typedef ap_int<RESPONSE_BITS> response_t;
+
 enum direction{
 	grad0,grad45,grad90,grad135
 };
@@ -20,295 +136,609 @@ enum type{
 	flat,corner,edge
 };
 
+/*
+ * Layouts of the 32 bit beats RawToGrayArray reads. Mono carries four 8 bit
+ * pixels per beat, YUV422 two pixels as Y0 U Y1 V. The Bayer modes read an
+ * RGGB mosaic of twice the frame size in both directions, four samples per
+ * beat, and make one pixel from every 2x2 quad: the mean of the two greens
+ * or the luma of the quad. Every row starts on a new beat.
+ */
+enum rawFormat{
+	rawMono,rawYUV422,rawBayerGreen,rawBayerLuma
+};
+
+/*
+ * Gradient magnitude and direction of the edge detector in one 16 bit word,
+ * the direction in bits 8 and 9.
+ */
 struct directedPixel{
-	uint8_t pixel;
-	direction dir;
+	uint16_t word;
+
+	uint8_t pixel() const {
+		return word & 0xff;
+	}
+	direction dir() const {
+		return (direction) ((word >> 8) & 3);
+	}
+	void set(uint8_t pixel, direction dir) {
+		word = pixel | (dir << 8);
+	}
 };
+
+/*
+ * Pixel of the corner detector in one 16 bit word: the type in the top two
+ * bits and the score below. Scores saturate at SCORE_MAX, the corner scores
+ * of a frame stay far below it.
+ */
+const int SCORE_BITS = 14;
+const int32_t SCORE_MAX = (1 << SCORE_BITS) - 1;
+
 struct weightPixel{
-	uint16_t value;
-	type t;
+	uint16_t word;
+
+	uint16_t value() const {
+		return word & SCORE_MAX;
+	}
+	type t() const {
+		return (type) (word >> SCORE_BITS);
+	}
+	void set(type t, int32_t value) {
+		if (value < 0)
+			value = 0;
+		else if (value > SCORE_MAX)
+			value = SCORE_MAX;
+		word = (t << SCORE_BITS) | value;
+	}
 };
+struct taggedPixel{
+	weightPixel pixel;
+	uint8_t id;
+};
+struct thresholdState{
+	int32_t max;
+	bool valid;
+	int32_t high;
+};
+struct cornerRecord{
+	uint16_t x;
+	uint16_t y;
+	uint16_t score;
+	uint8_t level;
+	bool last;
+};
+
+/*
+ * Per frame status of the hardware, read over AXI-Lite. It is written once
+ * the last pixel of a frame has left FrameStatus, so it always describes a
+ * complete frame and pixels is rows * cols of that frame. A frame in
+ * progress shows in the live counters of PixelProgress and FrameStatus.
+ */
+struct harrisStatus{
+	uint32_t frames;
+	uint32_t pixels;
+	uint32_t corners;
+	uint32_t edges;
+	uint16_t peak;
+};
+
+/* Stages of harris(), the edge stages are the edge branch of harrisCanny() */
+enum harrisStage{
+	stageGray,stageGauss,stageSobel,stageMul,stageTensor,stageResponse,
+	stageMinMax,stageDecide,stageSuppress,stageEdgeGradient,stageEdgeSuppress,
+	stageHysteresis,stageBorder,STAGE_COUNT
+};
+
+inline const char *stageName(int stage) {
+	static const char *names[STAGE_COUNT] = { "gray", "gauss", "sobel",
+			"mul", "tensor", "response", "minmax", "decide", "suppress",
+			"edge_gradient", "edge_suppress", "hysteresis", "border" };
+	return names[stage];
+}
+
+#if defined(HARRIS_STATS) && !defined(__SYNTHESIS__)
+/*
+ * Software statistics of the stage chain, enabled with -DHARRIS_STATS.
+ * Every stage adds its run time and the pixels it read and wrote, the
+ * totals run until resetStatistics().
+ */
+struct stageStats{
+	uint64_t ns;
+	uint64_t pixelsIn;
+	uint64_t pixelsOut;
+	uint32_t calls;
+};
+struct harrisStats{
+	stageStats stage[STAGE_COUNT];
+	uint32_t frames;
+	uint64_t corners;
+	uint64_t edges;
+};
+
+inline harrisStats &statistics() {
+	static harrisStats stats = harrisStats();
+	return stats;
+}
+
+/*
+ * Taken by every update of statistics(), so stages running on different
+ * threads (contexts, dataflow::harris) add up correctly. Read the totals
+ * once those threads are done.
+ */
+inline std::mutex &statisticsLock() {
+	static std::mutex lock;
+	return lock;
+}
+
+inline void resetStatistics() {
+	std::lock_guard<std::mutex> guard(statisticsLock());
+	statistics() = harrisStats();
+}
+
+inline void recordStage(int stage, std::chrono::steady_clock::time_point begin,
+		uint64_t pixelsIn, uint64_t pixelsOut) {
+	uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - begin).count();
+	std::lock_guard<std::mutex> guard(statisticsLock());
+	stageStats &s = statistics().stage[stage];
+	s.ns += ns;
+	s.pixelsIn += pixelsIn;
+	s.pixelsOut += pixelsOut;
+	s.calls++;
+}
+
+inline void recordFrame(weightPixel *frame, int n) {
+	uint64_t corners = 0, edges = 0;
+	for (int i = 0; i < n; i++) {
+		if (frame[i].t() == corner)
+			corners++;
+		else if (frame[i].t() == edge)
+			edges++;
+	}
+	std::lock_guard<std::mutex> guard(statisticsLock());
+	harrisStats &stats = statistics();
+	stats.frames++;
+	stats.corners += corners;
+	stats.edges += edges;
+}
+
+#define HARRIS_STAGE(stage, in, out, ...) do { \
+		std::chrono::steady_clock::time_point stageBegin = std::chrono::steady_clock::now(); \
+		__VA_ARGS__; \
+		recordStage(stage, stageBegin, in, out); \
+	} while (0)
+#define HARRIS_FRAME(frame, n) recordFrame(frame, n)
+#else
+#define HARRIS_STAGE(stage, in, out, ...) __VA_ARGS__
+#define HARRIS_FRAME(frame, n)
+#endif
 
 class imgFunctions {
 public:
+	template<int WIDTH, int HEIGHT, typename KERNEL, typename T>
+	void Convolve(uint8_t *imageIn, T *imageOut, int rows, int cols);
+	template<int WIDTH, int HEIGHT>
+	void Gauss3(uint8_t *imageIn, uint8_t *imageOut, int rows, int cols);
+	template<int WIDTH, int HEIGHT>
+	void Gauss5(uint8_t *imageIn, uint8_t *imageOut, int rows, int cols);
+	template<int WIDTH, int HEIGHT>
+	void SobelX(uint8_t *imageIn, gradient_t *imageOut, int rows, int cols);
+	template<int WIDTH, int HEIGHT>
+	void SobelY(uint8_t *imageIn, gradient_t *imageOut, int rows, int cols);
+	template<int WIDTH, int HEIGHT>
+	void Sobel(uint8_t *imageIn, directedPixel *imageOut, int rows, int cols);
+	template<int WIDTH, int HEIGHT, typename T, typename P>
+	void Mul(T *image1,T *image2, P *imageOut, int rows, int cols);
+	template<int WIDTH, int HEIGHT, typename T>
+	void Dublicate(T *imageIn, T *imageOut1, T *imageOut2, int rows, int cols);
 	template<int WIDTH, int HEIGHT>
-	void Gauss3(uint8_t *imageIn, uint8_t *imageOut);
+	void EdgeGradient(gradient_t *gradX, gradient_t *gradY, directedPixel *imageOut, int rows, int cols);
 	template<int WIDTH, int HEIGHT>
-	void Gauss5(uint8_t *imageIn, uint8_t *imageOut);
+	void NonMaxSuppression(directedPixel* imageIn, uint8_t* imageOut, int rows, int cols);
 	template<int WIDTH, int HEIGHT>
-	void SobelX(uint8_t *imageIn, uint8_t *imageOut);
+	void canny(RGB_IMAGE &src, RGB_IMAGE &dst,int low,int high, int rows, int cols);
 	template<int WIDTH, int HEIGHT>
-	void SobelY(uint8_t *imageIn, uint8_t *imageOut);
+	void harrisCanny(RGB_IMAGE &src, weightPixel *corners, uint8_t *edges, int thresUp, int low, int high, int rows, int cols);
 	template<int WIDTH, int HEIGHT>
-	void Sobel(uint8_t *imageIn, directedPixel *imageOut);
+	void MatToGrayArray(RGB_IMAGE &in, uint8_t* out, int rows, int cols);
 	template<int WIDTH, int HEIGHT>
-	void Mul(uint8_t *image1,uint8_t *image2, uint16_t *imageOut);
+	void ArrayToMat(uint8_t* in, RGB_IMAGE &out, int rows, int cols);
 	template<int WIDTH, int HEIGHT>
-	void Dublicate(uint8_t *imageIn, uint8_t *imageOut1, uint8_t *imageOut2);
+	void NonMaxSurpression(weightPixel *imageIn,weightPixel *imageOut, int rows, int cols);
 	template<int WIDTH, int HEIGHT>
-	void NonMaxSuppression(directedPixel* imageIn, uint8_t* imageOut);
+	void RawToGrayArray(AXI_STREAM &in, uint8_t *out, int format, int rows, int cols);
 	template<int WIDTH, int HEIGHT>
-	void canny(RGB_IMAGE &src, RGB_IMAGE &dst,int hyst_thres);
+	void harrisGray(uint8_t *gray, weightPixel *dst,int thresUp, int rows, int cols, int target);
 	template<int WIDTH, int HEIGHT>
-	void MatToGrayArray(RGB_IMAGE &in, uint8_t* out);
+	void harris(RGB_IMAGE &src, weightPixel *dst,int thresUp, int rows, int cols, int target);
 	template<int WIDTH, int HEIGHT>
-	void ArrayToMat(uint8_t* in, RGB_IMAGE &out);
+	void harrisStreaming(RGB_IMAGE &src, weightPixel *dst,int thresUp, int rows, int cols);
 	template<int WIDTH, int HEIGHT>
-	void NonMaxSurpression(weightPixel *imageIn,weightPixel *imageOut);
+	bool harrisAdaptive(RGB_IMAGE &src, weightPixel *dst,int thresUp,thresholdState &state,int smoothShift, int rows, int cols, int target, bool reset);
+	template<int WIDTH, int HEIGHT, int STREAMS>
+	void harrisMultiStream(AXI_TAGGED_STREAM &src, taggedPixel *dst, int *thresUp, int smoothShift, int rowCount, int rows, int cols);
 	template<int WIDTH, int HEIGHT>
-	void harris(RGB_IMAGE &src, weightPixel *dst,int thresUp);
+	void FrameStatus(weightPixel *imageIn, weightPixel *imageOut, harrisStatus &status, volatile uint32_t &progress, int rows, int cols);
+	template<int WIDTH, int HEIGHT>
+	void PixelProgress(RGB_IMAGE &imageIn, RGB_IMAGE &imageOut, volatile uint32_t &progress, int rows, int cols);
+	template<int WIDTH, int HEIGHT, typename T>
+	void PixelProgress(T *imageIn, T *imageOut, volatile uint32_t &progress, int rows, int cols);
+	template<int WIDTH, int HEIGHT, int N>
+	void CornerList(weightPixel *imageIn, cornerRecord *listOut, uint16_t &count, int rows, int cols);
+	template<int WIDTH, int HEIGHT, int GX, int GY, int K>
+	void GridCornerList(weightPixel *imageIn, cornerRecord *listOut, uint16_t &count, int gridCols, int gridRows, int rows, int cols);
+	template<int WIDTH, int HEIGHT, int LEVELS, int N>
+	void harrisPyramid(RGB_IMAGE &src, cornerRecord *listOut, uint16_t &count, int thresUp, int rows, int cols);
 
 };
 
 template<int WIDTH, int HEIGHT>
-void MatToGrayArray(RGB_IMAGE &in, uint8_t* out) {
+void MatToGrayArray(RGB_IMAGE &in, uint8_t* out, int rows = HEIGHT, int cols = WIDTH) {
 	hls::Scalar<3,uint8_t> pixel_value;
-	loopPixel: for (int y = 0; y < HEIGHT; y++) {
-		for (int x = 0; x < WIDTH; x++) {
+	loopPixel: for (int y = 0; y < rows; y++) {
+#pragma HLS LOOP_TRIPCOUNT max=HEIGHT
+		for (int x = 0; x < cols; x++) {
+#pragma HLS LOOP_TRIPCOUNT max=WIDTH
 #pragma HLS loop_flatten off
 #pragma HLS pipeline II=1
 			in >> pixel_value;
 			uint8_t red = (pixel_value.val[0] * 77) >> 8;			//*0.299
 			uint8_t green = (pixel_value.val[1] * 150) >> 8;		//*0.587
 			uint8_t blue = (pixel_value.val[2] * 28) >> 8;			//0.114
-			out[x + y * WIDTH] = red + green + blue;
+			out[x + y * cols] = red + green + blue;
 		}
 	}
 }
 
 template<int WIDTH, int HEIGHT>
-void ArrayToMat(uint8_t* in, RGB_IMAGE &out) {
+void ArrayToMat(uint8_t* in, RGB_IMAGE &out, int rows = HEIGHT, int cols = WIDTH) {
 	hls::Scalar<3,uint8_t> px1;
 
-	backConvertLoop: for (int y = 0; y < HEIGHT; y++) {
-		for (int x = 0; x < WIDTH; x++) {
+	backConvertLoop: for (int y = 0; y < rows; y++) {
+#pragma HLS LOOP_TRIPCOUNT max=HEIGHT
+		for (int x = 0; x < cols; x++) {
+#pragma HLS LOOP_TRIPCOUNT max=WIDTH
 #pragma HLS PIPELINE II=1
 #pragma HLS LOOP_FLATTEN off
-			px1.val[0] = in[x + y * WIDTH];
-			px1.val[1] = in[x + y * WIDTH];
-			px1.val[2] = in[x + y * WIDTH];
+			px1.val[0] = in[x + y * cols];
+			px1.val[1] = in[x + y * cols];
+			px1.val[2] = in[x + y * cols];
 			out << px1;
 		}
 	}
 }
 
-template<int WIDTH, int HEIGHT>
-void Gauss3(uint8_t *imageIn, uint8_t *imageOut) {
-
-	const int K_SIZE = 3;
-	uint8_t line_buf[K_SIZE][WIDTH];
-	uint8_t window_buf[K_SIZE][K_SIZE];
-	const int KERNEL[K_SIZE][K_SIZE] = { { 1, 2, 1 }, { 2, 4, 2 }, { 1, 2, 1 } };
+/*
+ * Convolution kernels. A descriptor gives the window size, the right shift
+ * that normalises the sum and the taps as a constexpr function, so Convolve
+ * can take the kernel apart at compile time.
+ */
+constexpr int GAUSS3_TAPS[3][3] = { { 1, 2, 1 }, { 2, 4, 2 }, { 1, 2, 1 } };
+constexpr int GAUSS5_TAPS[5][5] = { { 1, 4, 6, 4, 1 }, { 4, 16, 24, 16, 4 }, { 6,
+		24, 36, 24, 6 }, { 4, 16, 24, 16, 4 }, { 1, 4, 6, 4, 1 } };
+constexpr int SOBELX_TAPS[3][3] = { { 1, 0, -1 }, { 2, 0, -2 }, { 1, 0, -1 } };
+constexpr int SOBELY_TAPS[3][3] = { { 1, 2, 1 }, { 0, 0, 0 }, { -1, -2, -1 } };
+
+struct gauss3Kernel {
+	static const int SIZE = 3;
+	static const int SHIFT = 4;
+	static constexpr int tap(int y, int x) { return GAUSS3_TAPS[y][x]; }
+};
 
-#pragma HLS ARRAY_PARTITION variable=window_buf complete dim=0
-#pragma HLS ARRAY_PARTITION variable=KERNEL complete dim=0
-#pragma HLS ARRAY_RESHAPE variable=line_buf complete dim=1
+struct gauss5Kernel {
+	static const int SIZE = 5;
+	static const int SHIFT = 8;
+	static constexpr int tap(int y, int x) { return GAUSS5_TAPS[y][x]; }
+};
 
+struct sobelXKernel {
+	static const int SIZE = 3;
+	static const int SHIFT = 0;
+	static constexpr int tap(int y, int x) { return SOBELX_TAPS[y][x]; }
+};
 
-	gaussLoop:
-	for (int y = 0; y < HEIGHT; y++) {
-		for (int x = 0; x < WIDTH; x++) {
-		#pragma HLS PIPELINE II=1
-		#pragma HLS LOOP_FLATTEN off
+struct sobelYKernel {
+	static const int SIZE = 3;
+	static const int SHIFT = 0;
+	static constexpr int tap(int y, int x) { return SOBELY_TAPS[y][x]; }
+};
 
-			int pix_gauss = 0;
-			for (int yl = 0; yl < K_SIZE - 1; yl++)
-				line_buf[yl][x] = line_buf[yl + 1][x];
+/* Index of the first non zero tap in row major order */
+template<typename KERNEL>
+constexpr int kernelPivot(int i = 0) {
+	return i == KERNEL::SIZE * KERNEL::SIZE
+			|| KERNEL::tap(i / KERNEL::SIZE, i % KERNEL::SIZE) != 0 ?
+			i : kernelPivot<KERNEL>(i + 1);
+}
 
+/* True if every tap is col(y) * row(x) / pivot, i.e. the kernel has rank one */
+template<typename KERNEL>
+constexpr bool kernelRankOne(int py, int px, int i = 0) {
+	return i == KERNEL::SIZE * KERNEL::SIZE
+			|| (KERNEL::tap(i / KERNEL::SIZE, i % KERNEL::SIZE) * KERNEL::tap(py, px)
+					== KERNEL::tap(i / KERNEL::SIZE, px) * KERNEL::tap(py, i % KERNEL::SIZE)
+					&& kernelRankOne<KERNEL>(py, px, i + 1));
+}
 
-			line_buf[K_SIZE - 1][x] = imageIn[x + y * WIDTH];
+/* log2 of v, -1 if v is no power of two */
+constexpr int powerOfTwo(int v, int bits = 0) {
+	return v == 1 ? bits : (v <= 0 || (v & 1)) ? -1 : powerOfTwo(v >> 1, bits + 1);
+}
 
-			for (int yw = 0; yw < K_SIZE; yw++) {
-				for (int xw = 0; xw < K_SIZE - 1; xw++) {
-					window_buf[yw][xw] = window_buf[yw][xw + 1];
-				}
-			}
+/* Tap i of the row (ROW) or column factor of a separable kernel */
+template<typename KERNEL, bool ROW>
+constexpr int kernelFactor(int i) {
+	return ROW ? KERNEL::tap(kernelPivot<KERNEL>() / KERNEL::SIZE, i)
+			: KERNEL::tap(i, kernelPivot<KERNEL>() % KERNEL::SIZE);
+}
 
-			for (int yw = 0; yw < K_SIZE; yw++)
-				window_buf[yw][K_SIZE - 1] = line_buf[yw][x];
+/* True if factor(i) == sign * factor(SIZE - 1 - i) for every tap */
+template<typename KERNEL, bool ROW>
+constexpr bool kernelMirrored(int sign, int i = 0) {
+	return i == KERNEL::SIZE || (kernelFactor<KERNEL,ROW>(i)
+			== sign * kernelFactor<KERNEL,ROW>(KERNEL::SIZE - 1 - i)
+			&& kernelMirrored<KERNEL,ROW>(sign, i + 1));
+}
 
+/*
+ * What Convolve knows about a kernel. A rank one kernel whose pivot tap is a
+ * power of two is SEPARABLE: the column factor times the row factor gives
+ * the taps scaled by the pivot, which is folded into SHIFT. The symmetry of
+ * the factors is +1, -1 for antisymmetric or 0.
+ */
+template<typename KERNEL>
+struct kernelTraits {
+	static const int K_SIZE = KERNEL::SIZE;
+	static const int PIVOT = kernelPivot<KERNEL>();
+	static_assert(PIVOT < K_SIZE * K_SIZE, "kernel without taps");
+	static const int PIVOT_SHIFT = powerOfTwo(KERNEL::tap(PIVOT / K_SIZE, PIVOT % K_SIZE));
+	static const bool SEPARABLE = PIVOT_SHIFT >= 0
+			&& kernelRankOne<KERNEL>(PIVOT / K_SIZE, PIVOT % K_SIZE);
+	static const int SHIFT = KERNEL::SHIFT + (SEPARABLE ? PIVOT_SHIFT : 0);
+	static const int ROW_SYMMETRY = kernelMirrored<KERNEL,true>(1) ? 1
+			: kernelMirrored<KERNEL,true>(-1) ? -1 : 0;
+	static const int COL_SYMMETRY = kernelMirrored<KERNEL,false>(1) ? 1
+			: kernelMirrored<KERNEL,false>(-1) ? -1 : 0;
+};
 
-			for (int yw = 0; yw < K_SIZE; yw++) {
-				for (int xw = 0; xw < K_SIZE; xw++) {
-					pix_gauss += window_buf[yw][xw] * KERNEL[yw][xw];
-				}
-			}
+/* v * t for a constant tap t, as shifts and adds of the set bits of t */
+inline int shiftAdd(int v, int t) {
+	int m = t < 0 ? -t : t;
+	int sum = 0;
+	for (int b = 0; b < 16; b++)
+		if (m & (1 << b))
+			sum += v << b;
+	return t < 0 ? -sum : sum;
+}
 
-			pix_gauss >>= 4;
-			imageOut[x + y * WIDTH] = pix_gauss;
-		}
+/*
+ * Dot product of K_SIZE values with the row (ROW) or column factor of a
+ * separable kernel. Mirrored taps are added or subtracted before they are
+ * scaled, so a symmetric factor costs K/2 + 1 scalings.
+ */
+template<typename KERNEL, bool ROW, typename V>
+inline int kernelDot(const V *v) {
+	const int K_SIZE = KERNEL::SIZE;
+	const int SYMMETRY = ROW ? kernelTraits<KERNEL>::ROW_SYMMETRY
+			: kernelTraits<KERNEL>::COL_SYMMETRY;
+	int sum = 0;
+	for (int i = 0; i < K_SIZE / 2; i++) {
+		int a = v[i];
+		int b = v[K_SIZE - 1 - i];
+		if (SYMMETRY > 0)
+			sum += shiftAdd(a + b, kernelFactor<KERNEL,ROW>(i));
+		else if (SYMMETRY < 0)
+			sum += shiftAdd(a - b, kernelFactor<KERNEL,ROW>(i));
+		else
+			sum += shiftAdd(a, kernelFactor<KERNEL,ROW>(i))
+					+ shiftAdd(b, kernelFactor<KERNEL,ROW>(K_SIZE - 1 - i));
 	}
+	if (K_SIZE % 2)
+		sum += shiftAdd(v[K_SIZE / 2], kernelFactor<KERNEL,ROW>(K_SIZE / 2));
+	return sum;
 }
 
-template<int WIDTH, int HEIGHT>
-void Gauss5(uint8_t *imageIn, uint8_t *imageOut) {
-
-	const int K_SIZE = 5;
-	uint8_t line_buf[K_SIZE][WIDTH];
-	uint8_t window_buf[K_SIZE][K_SIZE];
-	const int KERNEL[K_SIZE][K_SIZE] = { { 1, 4, 6, 4, 1 }, { 4, 16, 24, 16, 4 }, { 6,
-			24, 36, 24, 6 }, { 4, 16, 24, 16, 4 }, { 1, 4, 6, 4, 1 } };
-
-#pragma HLS ARRAY_PARTITION variable=window_buf complete dim=0
-#pragma HLS ARRAY_PARTITION variable=KERNEL complete dim=0
-#pragma HLS ARRAY_RESHAPE variable=line_buf complete dim=1
-
-
-	gaussLoop:
-	for (int y = 0; y < HEIGHT; y++) {
-		for (int x = 0; x < WIDTH; x++) {
-		#pragma HLS PIPELINE II=1
-		#pragma HLS LOOP_FLATTEN off
-
-			int pix_gauss = 0;
-
-			for (int yl = 0; yl < K_SIZE - 1; yl++) {
-				line_buf[yl][x] = line_buf[yl + 1][x];
-			}
-
-			line_buf[K_SIZE - 1][x] = imageIn[x + y * WIDTH];
-
-			for (int yw = 0; yw < K_SIZE; yw++) {
-				for (int xw = 0; xw < K_SIZE - 1; xw++) {
-					window_buf[yw][xw] = window_buf[yw][xw + 1];
-				}
-			}
-
-			// write to window buffer
-			for (int yw = 0; yw < K_SIZE; yw++) {
-				window_buf[yw][K_SIZE - 1] = line_buf[yw][x];
-			}
-
-			for (int yw = 0; yw < K_SIZE; yw++) {
-				for (int xw = 0; xw < K_SIZE; xw++) {
-					pix_gauss += window_buf[yw][xw] * KERNEL[yw][xw];
-				}
-			}
-
-			pix_gauss >>= 8;
-			imageOut[x + y * WIDTH] = pix_gauss;
+/*
+ * Normalised sum of a K x K window that starts at column c of window_buf,
+ * for the stages that keep their own window.
+ */
+template<typename KERNEL, typename WIN>
+inline int convolveAt(WIN &window_buf, int c) {
+	const int K_SIZE = KERNEL::SIZE;
+	int sum = 0;
+	if (kernelTraits<KERNEL>::SEPARABLE) {
+		int colSum[K_SIZE];
+		for (int xw = 0; xw < K_SIZE; xw++) {
+			int column[K_SIZE];
+			for (int yw = 0; yw < K_SIZE; yw++)
+				column[yw] = window_buf[yw][c + xw];
+			colSum[xw] = kernelDot<KERNEL,false>(column);
 		}
+		sum = kernelDot<KERNEL,true>(colSum);
+	} else {
+		for (int yw = 0; yw < K_SIZE; yw++)
+			for (int xw = 0; xw < K_SIZE; xw++)
+				sum += shiftAdd(window_buf[yw][c + xw], KERNEL::tap(yw, xw));
 	}
+	return sum >> kernelTraits<KERNEL>::SHIFT;
 }
 
-template<int WIDTH, int HEIGHT>
-void SobelX(uint8_t *imageIn, uint8_t *imageOut) {
-	const int K_SIZE = 3;
+/*
+ * Line buffer of a K x K window stage. step stores the pixel and hands out
+ * the column of the window that ends at it, oldest row first.
+ */
+template<int WIDTH, int K_SIZE>
+struct lineWindow {
 	uint8_t line_buf[K_SIZE][WIDTH];
-	uint8_t window_buf[K_SIZE][K_SIZE];
-	const int KERNEL[K_SIZE][K_SIZE] = { { 1, 0, -1 }, { 2, 0, -2 },
-			{ 1, 0, -1 } };
 
-#pragma HLS ARRAY_PARTITION variable=window_buf complete dim=0
-#pragma HLS ARRAY_PARTITION variable=KERNEL complete dim=0
-#pragma HLS ARRAY_RESHAPE variable=line_buf complete dim=1
+	void reset() {
+		for (int x = 0; x < WIDTH; x++)
+			for (int i = 0; i < K_SIZE; i++)
+				line_buf[i][x] = 0;
+	}
 
-	SobelXLoop:
-	for (int y = 0; y < HEIGHT; y++) {
-		for (int x = 0; x < WIDTH; x++) {
-			#pragma HLS PIPELINE II=1
-			#pragma HLS LOOP_FLATTEN off
+	void step(int x, uint8_t in, uint8_t *column) {
+		for (int yl = 0; yl < K_SIZE - 1; yl++)
+			line_buf[yl][x] = line_buf[yl + 1][x];
+		line_buf[K_SIZE - 1][x] = in;
+		for (int yl = 0; yl < K_SIZE; yl++)
+			column[yl] = line_buf[yl][x];
+	}
+};
 
-			int pixel = 0;
+/*
+ * Window of Convolve that takes one column per pixel. The separable kernel
+ * keeps the K column sums and finishes with the row factor, the others keep
+ * the K x K pixels.
+ */
+template<typename KERNEL, bool SEPARABLE = kernelTraits<KERNEL>::SEPARABLE>
+struct convolveWindow {
+	int window_buf[KERNEL::SIZE];
 
-			for (int yl = 0; yl < K_SIZE - 1; yl++) {
-				line_buf[yl][x] = line_buf[yl + 1][x];
-			}
+	void reset() {
+		for (int i = 0; i < KERNEL::SIZE; i++)
+			window_buf[i] = 0;
+	}
 
-			line_buf[K_SIZE - 1][x] = imageIn[x + y * WIDTH];
+	int step(const uint8_t *column) {
+		for (int xw = 0; xw < KERNEL::SIZE - 1; xw++)
+			window_buf[xw] = window_buf[xw + 1];
+		window_buf[KERNEL::SIZE - 1] = kernelDot<KERNEL,false>(column);
+		return kernelDot<KERNEL,true>(window_buf) >> kernelTraits<KERNEL>::SHIFT;
+	}
+};
 
-			for (int yw = 0; yw < K_SIZE; yw++) {
-				for (int xw = 0; xw < K_SIZE - 1; xw++) {
-					window_buf[yw][xw] = window_buf[yw][xw + 1];
-				}
-			}
+template<typename KERNEL>
+struct convolveWindow<KERNEL, false> {
+	uint8_t window_buf[KERNEL::SIZE][KERNEL::SIZE];
 
-			for (int yw = 0; yw < K_SIZE; yw++) {
-				window_buf[yw][K_SIZE - 1] = line_buf[yw][x];
-			}
+	void reset() {
+		for (int yw = 0; yw < KERNEL::SIZE; yw++)
+			for (int xw = 0; xw < KERNEL::SIZE; xw++)
+				window_buf[yw][xw] = 0;
+	}
 
-			for (int yw = 0; yw < K_SIZE; yw++) {
-				for (int xw = 0; xw < K_SIZE; xw++) {
-					pixel += window_buf[yw][xw] * KERNEL[yw][xw];
-				}
-			}
+	int step(const uint8_t *column) {
+		for (int yw = 0; yw < KERNEL::SIZE; yw++) {
+			for (int xw = 0; xw < KERNEL::SIZE - 1; xw++)
+				window_buf[yw][xw] = window_buf[yw][xw + 1];
+			window_buf[yw][KERNEL::SIZE - 1] = column[yw];
+		}
+		return convolveAt<KERNEL>(window_buf, 0);
+	}
+};
 
-			imageOut[x + y * WIDTH] = pixel;
+/**
+ * Causal K x K convolution with the kernel descriptor KERNEL, the output is
+ * the normalised sum of the window that ends at the current pixel.
+ * Separable kernels run a column pass on the line buffer followed by a row
+ * pass on the column sums, so the line buffer stays 8 bit wide.
+ */
+template<int WIDTH, int HEIGHT, typename KERNEL, typename T>
+void Convolve(uint8_t *imageIn, T *imageOut, int rows = HEIGHT, int cols = WIDTH) {
+	lineWindow<WIDTH, KERNEL::SIZE> lines;
+	convolveWindow<KERNEL> window;
+	uint8_t column[KERNEL::SIZE];
+#pragma HLS ARRAY_RESHAPE variable=lines.line_buf complete dim=1
+#pragma HLS ARRAY_PARTITION variable=window.window_buf complete dim=0
+#pragma HLS ARRAY_PARTITION variable=column complete dim=0
+
+	lines.reset();
+	window.reset();
+
+	convolveLoop:
+	for (int y = 0; y < rows; y++) {
+#pragma HLS LOOP_TRIPCOUNT max=HEIGHT
+		for (int x = 0; x < cols; x++) {
+#pragma HLS LOOP_TRIPCOUNT max=WIDTH
+#pragma HLS PIPELINE II=1
+#pragma HLS LOOP_FLATTEN off
+			lines.step(x, imageIn[x + y * cols], column);
+			imageOut[x + y * cols] = window.step(column);
 		}
 	}
 }
 
 template<int WIDTH, int HEIGHT>
-void SobelY(uint8_t *imageIn, uint8_t *imageOut) {
-	const int K_SIZE = 3;
-	uint8_t line_buf[K_SIZE][WIDTH];
-	uint8_t window_buf[K_SIZE][K_SIZE];
-	const int KERNEL[K_SIZE][K_SIZE] = { { 1, 2, -1 }, { 0, 0, 0 }, { 1, 2, -1 } };
-
-#pragma HLS ARRAY_PARTITION variable=window_buf complete dim=0
-#pragma HLS ARRAY_PARTITION variable=KERNEL complete dim=0
-#pragma HLS ARRAY_RESHAPE variable=line_buf complete dim=1
-
-	SobelXLoop:
-	for (int y = 0; y < HEIGHT; y++) {
-		for (int x = 0; x < WIDTH; x++) {
-			#pragma HLS PIPELINE II=1
-			#pragma HLS LOOP_FLATTEN off
-
-			uint8_t pixel = 0;
-
-			for (int yl = 0; yl < K_SIZE - 1; yl++) {
-				line_buf[yl][x] = line_buf[yl + 1][x];
-			}
+void Gauss3(uint8_t *imageIn, uint8_t *imageOut, int rows = HEIGHT, int cols = WIDTH) {
+	Convolve<WIDTH,HEIGHT,gauss3Kernel>(imageIn, imageOut, rows, cols);
+}
 
-			line_buf[K_SIZE - 1][x] = imageIn[x + y * WIDTH];
+template<int WIDTH, int HEIGHT>
+void Gauss5(uint8_t *imageIn, uint8_t *imageOut, int rows = HEIGHT, int cols = WIDTH) {
+	Convolve<WIDTH,HEIGHT,gauss5Kernel>(imageIn, imageOut, rows, cols);
+}
 
-			for (int yw = 0; yw < K_SIZE; yw++) {
-				for (int xw = 0; xw < K_SIZE - 1; xw++) {
-					window_buf[yw][xw] = window_buf[yw][xw + 1];
-				}
-			}
+template<int WIDTH, int HEIGHT>
+void SobelX(uint8_t *imageIn, gradient_t *imageOut, int rows = HEIGHT, int cols = WIDTH) {
+	Convolve<WIDTH,HEIGHT,sobelXKernel>(imageIn, imageOut, rows, cols);
+}
 
-			for (int yw = 0; yw < K_SIZE; yw++) {
-				window_buf[yw][K_SIZE - 1] = line_buf[yw][x];
-			}
+template<int WIDTH, int HEIGHT>
+void SobelY(uint8_t *imageIn, gradient_t *imageOut, int rows = HEIGHT, int cols = WIDTH) {
+	Convolve<WIDTH,HEIGHT,sobelYKernel>(imageIn, imageOut, rows, cols);
+}
 
-			for (int yw = 0; yw < K_SIZE; yw++) {
-				for (int xw = 0; xw < K_SIZE; xw++) {
-					pixel += window_buf[yw][xw] * KERNEL[yw][xw];
-				}
-			}
+/* Gradient magnitude selected by CANNY_MAGNITUDE, saturated to 255 */
+inline uint8_t gradientMagnitude(int gx, int gy) {
+#if CANNY_MAGNITUDE == CANNY_MAGNITUDE_SQRT
+	int mag = hls::sqrt(float(gx * gx + gy * gy));
+#else
+	int ax = gx < 0 ? -gx : gx;
+	int ay = gy < 0 ? -gy : gy;
+#if CANNY_MAGNITUDE == CANNY_MAGNITUDE_L1
+	int mag = ax + ay;
+#else
+	// 15/16 max + 15/32 min, about 6% off the euclidean norm at worst
+	int hi = ax > ay ? ax : ay;
+	int lo = ax > ay ? ay : ax;
+	int mag = ((hi << 5) - (hi << 1) + (lo << 4) - lo) >> 5;
+#endif
+#endif
+	return mag > 255 ? 255 : mag;
+}
 
-			imageOut[x + y * WIDTH] = pixel;
-		}
-	}
+/*
+ * Direction class of a gradient, the same as binning gy * 256 / gx (rounded
+ * towards zero) at tan(22.5) = 106/256 and tan(67.5) = 618/256. The quotient
+ * is compared by cross multiplication with |gx|, so there is no divider.
+ */
+inline direction gradientDirection(int gx, int gy) {
+	if (gx == 0)
+		return grad90;
+	int num = gx < 0 ? -(gy << 8) : gy << 8;
+	int den = gx < 0 ? -gx : gx;
+	if (-618 * den < num && num <= -106 * den)
+		return grad135;
+	if (-106 * den < num && num < 107 * den)
+		return grad0;
+	if (107 * den <= num && num < 618 * den)
+		return grad45;
+	return grad90;
 }
 
 template<int WIDTH, int HEIGHT>
-void Sobel(uint8_t *imageIn, directedPixel *imageOut){
+void Sobel(uint8_t *imageIn, directedPixel *imageOut, int rows = HEIGHT, int cols = WIDTH){
     const int KERNEL_SIZE = 3;
 
-    uint8_t line_buf[KERNEL_SIZE][WIDTH];
-    uint8_t window_buf[KERNEL_SIZE][KERNEL_SIZE];
+    lineWindow<WIDTH, KERNEL_SIZE> lines;
+    convolveWindow<sobelXKernel> h_window;
+    convolveWindow<sobelYKernel> v_window;
+    uint8_t column[KERNEL_SIZE];
 
-    #pragma HLS ARRAY_RESHAPE variable=line_buf complete dim=1
-    #pragma HLS ARRAY_PARTITION variable=window_buf complete dim=0
+    #pragma HLS ARRAY_RESHAPE variable=lines.line_buf complete dim=1
+    #pragma HLS ARRAY_PARTITION variable=h_window.window_buf complete dim=0
+    #pragma HLS ARRAY_PARTITION variable=v_window.window_buf complete dim=0
+    #pragma HLS ARRAY_PARTITION variable=column complete dim=0
 
-
-    const int H_SOBEL_KERNEL[KERNEL_SIZE][KERNEL_SIZE] = {  { 1,  0, -1},
-                                                            { 2,  0, -2},
-                                                            { 1,  0, -1}   };
-
-    const int V_SOBEL_KERNEL[KERNEL_SIZE][KERNEL_SIZE] = {  { 1,  2,  1},
-                                                            { 0,  0,  0},
-                                                            {-1, -2, -1}   };
-
-    #pragma HLS ARRAY_PARTITION variable=H_SOBEL_KERNEL complete dim=0
-    #pragma HLS ARRAY_PARTITION variable=V_SOBEL_KERNEL complete dim=0
+    lines.reset();
+    h_window.reset();
+    v_window.reset();
 
     sobelXY:
-    for(int yi = 0; yi < HEIGHT; yi++) {
-        for(int xi = 0; xi < WIDTH; xi++) {
+    for(int yi = 0; yi < rows; yi++) {
+#pragma HLS LOOP_TRIPCOUNT max=HEIGHT
+        for(int xi = 0; xi < cols; xi++) {
+#pragma HLS LOOP_TRIPCOUNT max=WIDTH
             #pragma HLS PIPELINE II=1
             #pragma HLS LOOP_FLATTEN off
 
@@ -316,85 +746,55 @@ void Sobel(uint8_t *imageIn, directedPixel *imageOut){
             int pix_sobel;
             direction grad_sobel;
 
+            // both kernels share the line buffer
+            lines.step(xi, imageIn[xi + yi*cols], column);
 
-            for(int yl = 0; yl < KERNEL_SIZE - 1; yl++) {
-                line_buf[yl][xi] = line_buf[yl + 1][xi];
-            }
-
-            line_buf[KERNEL_SIZE - 1][xi] = imageIn[xi + yi*WIDTH];
-
-
-            for(int yw = 0; yw < KERNEL_SIZE; yw++) {
-                for(int xw = 0; xw < KERNEL_SIZE - 1; xw++) {
-                    window_buf[yw][xw] = window_buf[yw][xw + 1];
-                }
-            }
-
-            for(int yw = 0; yw < KERNEL_SIZE; yw++) {
-                window_buf[yw][KERNEL_SIZE - 1] = line_buf[yw][xi];
-            }
-
-
-            int pix_h_sobel = 0;
-            int pix_v_sobel = 0;
-
-            for(int yw = 0; yw < KERNEL_SIZE; yw++) {
-                for(int xw = 0; xw < KERNEL_SIZE; xw++) {
-                    pix_h_sobel += window_buf[yw][xw] * H_SOBEL_KERNEL[yw][xw];
-                }
-            }
-
-            // convolution using by vertical kernel
-            for(int yw = 0; yw < KERNEL_SIZE; yw++) {
-                for(int xw = 0; xw < KERNEL_SIZE; xw++) {
-                    pix_v_sobel += window_buf[yw][xw] * V_SOBEL_KERNEL[yw][xw];
-                }
-            }
-
-            pix_sobel = hls::sqrt(float(pix_h_sobel * pix_h_sobel + pix_v_sobel * pix_v_sobel));
-
-            // to consider saturation
-            if(255 < pix_sobel) {
-                pix_sobel = 255;
-            }
-
-            // evaluate gradient direction
-            int t_int;
-            if(pix_h_sobel != 0) {
-                t_int = pix_v_sobel * 256 / pix_h_sobel;
-            }
-            else {
-                t_int = 0x7FFFFFFF;
-            }
-
-            if(-618 < t_int && t_int <= -106) {
-                grad_sobel = grad135;
-            }
-            else if(-106 < t_int && t_int <= 106) {
-                grad_sobel = grad0;
-            }
+            int pix_h_sobel = h_window.step(column);
+            int pix_v_sobel = v_window.step(column);
 
-            else if(106 < t_int && t_int < 618) {
-                grad_sobel = grad45;
-            }
-            else {
-                grad_sobel = grad90;
-            }
+            pix_sobel = gradientMagnitude(pix_h_sobel, pix_v_sobel);
+            grad_sobel = gradientDirection(pix_h_sobel, pix_v_sobel);
 
 
-            if((KERNEL_SIZE < xi && xi < WIDTH - KERNEL_SIZE) &&
-               (KERNEL_SIZE < yi && yi < HEIGHT - KERNEL_SIZE)) {
-            	imageOut[xi + yi*WIDTH].pixel = pix_sobel;
-            	imageOut[xi + yi*WIDTH].dir  = grad_sobel;
+            if((KERNEL_SIZE < xi && xi < cols - KERNEL_SIZE) &&
+               (KERNEL_SIZE < yi && yi < rows - KERNEL_SIZE)) {
+            	imageOut[xi + yi*cols].set(pix_sobel, grad_sobel);
             }
             else {
-            	imageOut[xi + yi*WIDTH].pixel = 0;
-            	imageOut[xi + yi*WIDTH].dir  = grad_sobel;
+            	imageOut[xi + yi*cols].set(0, grad_sobel);
             }
         }
     }
 }
 
+/*
+ * Magnitude and direction of gradients that were computed elsewhere, the
+ * same as Sobel gives for them
+ */
+template<int WIDTH, int HEIGHT>
+void EdgeGradient(gradient_t *gradX, gradient_t *gradY, directedPixel *imageOut, int rows = HEIGHT, int cols = WIDTH){
+	const int KERNEL_SIZE = 3;
+
+	edgeGradientLoop:
+	for (int y = 0; y < rows; y++) {
+#pragma HLS LOOP_TRIPCOUNT max=HEIGHT
+		for (int x = 0; x < cols; x++) {
+#pragma HLS LOOP_TRIPCOUNT max=WIDTH
+#pragma HLS PIPELINE II=1
+#pragma HLS LOOP_FLATTEN off
+			int gx = gradX[x + y * cols];
+			int gy = gradY[x + y * cols];
+			directedPixel out;
+			if ((KERNEL_SIZE < x && x < cols - KERNEL_SIZE)
+					&& (KERNEL_SIZE < y && y < rows - KERNEL_SIZE))
+				out.set(gradientMagnitude(gx, gy), gradientDirection(gx, gy));
+			else
+				out.set(0, gradientDirection(gx, gy));
+			imageOut[x + y * cols] = out;
+		}
+	}
+}
+
 template<int WIDTH,int HEIGHT>
 void RGB2GRAY(uint8_t *imageIn, uint8_t *imageOut){
 	cvtColor:
@@ -414,14 +814,16 @@ void RGB2GRAY(uint8_t *imageIn, uint8_t *imageOut){
 }
 
 template<int WIDTH, int HEIGHT>
-void GRAY2RGB(uint8_t *imageIn, uint8_t *imageOut) {
+void GRAY2RGB(uint8_t *imageIn, uint8_t *imageOut, int rows = HEIGHT, int cols = WIDTH) {
 	int nextVal = 0;
 	cvtColor:
-	for (int y = 0; y < HEIGHT; y++) {
-		for (int x = 0; x < WIDTH; x ++) {
+	for (int y = 0; y < rows; y++) {
+#pragma HLS LOOP_TRIPCOUNT max=HEIGHT
+		for (int x = 0; x < cols; x ++) {
+#pragma HLS LOOP_TRIPCOUNT max=WIDTH
 			#pragma HLS PIPELINE II=1
 			#pragma HLS LOOP_FLATTEN off
-			uint8_t v = imageIn[x + y * WIDTH];
+			uint8_t v = imageIn[x + y * cols];
 			imageOut[nextVal] = v;
 			nextVal++;
 			imageOut[nextVal] = v;
@@ -432,8 +834,49 @@ void GRAY2RGB(uint8_t *imageIn, uint8_t *imageOut) {
 	}
 }
 
+/*
+ * Edge magnitude at the centre of a 3x3 window, or 0 where a neighbour
+ * along the gradient is larger
+ */
+template<typename WIN>
+inline uint8_t edgeSuppressAt(WIN &window_buf) {
+	const int WINDOW_SIZE = 3;
+	uint8_t value_nms = window_buf[WINDOW_SIZE / 2][WINDOW_SIZE / 2].pixel();
+	direction grad_nms = window_buf[WINDOW_SIZE / 2][WINDOW_SIZE / 2].dir();
+
+	if (grad_nms == grad0) {
+		if (value_nms < window_buf[WINDOW_SIZE / 2][0].pixel()
+				|| value_nms
+						< window_buf[WINDOW_SIZE / 2][WINDOW_SIZE - 1].pixel()) {
+			value_nms = 0;
+		}
+	}
+	else if (grad_nms == grad45) {
+		if (value_nms < window_buf[0][0].pixel()
+				|| value_nms
+						< window_buf[WINDOW_SIZE - 1][WINDOW_SIZE - 1].pixel()) {
+			value_nms = 0;
+		}
+	}
+	else if (grad_nms == grad90) {
+		if (value_nms < window_buf[0][WINDOW_SIZE - 1].pixel()
+				|| value_nms
+						< window_buf[WINDOW_SIZE - 1][WINDOW_SIZE / 2].pixel()) {
+			value_nms = 0;
+		}
+	}
+
+	else if (grad_nms == grad135) {
+		if (value_nms < window_buf[WINDOW_SIZE - 1][0].pixel()
+				|| value_nms < window_buf[0][WINDOW_SIZE - 1].pixel()) {
+			value_nms = 0;
+		}
+	}
+	return value_nms;
+}
+
 template<int WIDTH, int HEIGHT>
-void NonMaxSuppression(directedPixel* imageIn, uint8_t* imageOut) {
+void NonMaxSuppression(directedPixel* imageIn, uint8_t* imageOut, int rows = HEIGHT, int cols = WIDTH) {
 	const int WINDOW_SIZE = 3;
 	directedPixel line_buf[WINDOW_SIZE][WIDTH];
 	directedPixel window_buf[WINDOW_SIZE][WINDOW_SIZE];
@@ -442,20 +885,21 @@ void NonMaxSuppression(directedPixel* imageIn, uint8_t* imageOut) {
 #pragma HLS ARRAY_PARTITION variable=window_buf complete dim=0
 
 	nonMaxLoop:
-	for (int y = 0; y < HEIGHT; y++) {
-		for (int x = 0; x < WIDTH; x++) {
+	for (int y = 0; y < rows; y++) {
+#pragma HLS LOOP_TRIPCOUNT max=HEIGHT
+		for (int x = 0; x < cols; x++) {
+#pragma HLS LOOP_TRIPCOUNT max=WIDTH
 		#pragma HLS PIPELINE II=1
 		#pragma HLS LOOP_FLATTEN off
 
 
 			uint8_t value_nms;
-			direction grad_nms;
 
 
 			for (int i = 0; i < WINDOW_SIZE - 1; i++)
 				line_buf[i][x] = line_buf[i + 1][x];
 			
-			line_buf[WINDOW_SIZE - 1][x] = imageIn[x + y * WIDTH];
+			line_buf[WINDOW_SIZE - 1][x] = imageIn[x + y * cols];
 
 
 			for (int y2 = 0; y2 < WINDOW_SIZE; y2++) {
@@ -468,167 +912,539 @@ void NonMaxSuppression(directedPixel* imageIn, uint8_t* imageOut) {
 				window_buf[i][WINDOW_SIZE - 1] = line_buf[i][x];
 			
 
-			value_nms = window_buf[WINDOW_SIZE / 2][WINDOW_SIZE / 2].pixel;
-			grad_nms = window_buf[WINDOW_SIZE / 2][WINDOW_SIZE / 2].dir;
-
-			if (grad_nms == grad0) {
-				if (value_nms < window_buf[WINDOW_SIZE / 2][0].pixel
-						|| value_nms
-								< window_buf[WINDOW_SIZE / 2][WINDOW_SIZE - 1].pixel) {
-					value_nms = 0;
-				}
-			}
-			else if (grad_nms == grad45) {
-				if (value_nms < window_buf[0][0].pixel
-						|| value_nms
-								< window_buf[WINDOW_SIZE - 1][WINDOW_SIZE - 1].pixel) {
-					value_nms = 0;
-				}
-			}
-			else if (grad_nms == grad90) {
-				if (value_nms < window_buf[0][WINDOW_SIZE - 1].pixel
-						|| value_nms
-								< window_buf[WINDOW_SIZE - 1][WINDOW_SIZE / 2].pixel) {
-					value_nms = 0;
-				}
-			}
-
-			else if (grad_nms == grad135) {
-				if (value_nms < window_buf[WINDOW_SIZE - 1][0].pixel
-						|| value_nms < window_buf[0][WINDOW_SIZE - 1].pixel) {
-					value_nms = 0;
-				}
-			}
-
+			value_nms = edgeSuppressAt(window_buf);
 
-			if ((WINDOW_SIZE < x && x < WIDTH - WINDOW_SIZE)
-					&& (WINDOW_SIZE < y && y < HEIGHT - WINDOW_SIZE)) {
-				imageOut[x + y * WIDTH] = value_nms;
+			if ((WINDOW_SIZE < x && x < cols - WINDOW_SIZE)
+					&& (WINDOW_SIZE < y && y < rows - WINDOW_SIZE)) {
+				imageOut[x + y * cols] = value_nms;
 			} else {
-				imageOut[x + y * WIDTH] = 0;
+				imageOut[x + y * cols] = 0;
 			}
 		}
 	}
 }
 
-template<int WIDTH, int HEIGHT>
-void Hysteresis(uint8_t* src, uint8_t* dst, uint8_t thr) {
-    hysLoop:
-    for(int y = 0; y < HEIGHT; y++) {
-        for(int x = 0; x < WIDTH; x++) {
-            #pragma HLS PIPELINE II=1
-            #pragma HLS LOOP_FLATTEN off
-            uint8_t pix;
-            if(src[x + y*WIDTH] < thr) {
-            	pix = 0;
-            }else {
-            	pix = 255;
-            }
-            dst[x + y*WIDTH] = pix;
-        }
-    }
-}
+/* Hysteresis line buffer pixel: the run of its row it belongs to */
+struct hysteresisPixel{
+	uint16_t run;
+	bool edge;
+};
 
-template<uint32_t WIDTH, uint32_t HEIGHT>
-void ZeroBorder(uint8_t* src, uint8_t* dst,uint32_t size) {
+/*
+ * Component of a run as of the newest row: its id there, the root run of
+ * that row, or dead once the component stopped before the newest row. The
+ * strong flag of a dead component is final.
+ */
+struct hysteresisLabel{
+	uint16_t id;
+	bool alive;
+	bool strong;
+};
 
-	borderPadding:
-	for (int y = 0; y < HEIGHT; y++) {
-		for (int x = 0; x < WIDTH; x++) {
-			#pragma HLS PIPELINE II=1
-			#pragma HLS LOOP_FLATTEN off
-			uint8_t pix = src[x + y * WIDTH];
-			if ((size < x && x < WIDTH - size)
-					&& (size < y && y < HEIGHT - size)) {
-				dst[x + y * WIDTH] = pix;
-			} else {
-				dst[x + y * WIDTH] = 0;
-			}
-		}
-	}
-}
+/* The components of the row above that a run touches, one or two */
+struct hysteresisLink{
+	uint16_t run;
+	uint16_t above[2];
+	bool pair;
+};
+
+/*
+ * Streaming labelling of the hysteresis stage. Every row numbers its runs of
+ * edge pixels from 0. The pixel loop looks up the component of the pixel
+ * above right once, in the table of the row above, and only writes down
+ * which components a run touches. The end of the row merges these links,
+ * flattens the runs to their root run and moves every buffered row over to
+ * the components of the new row, so every table the pixel loop reads is one
+ * lookup deep. Links come in left to right and 8-connected components can't
+ * cross, so a component merged into one that starts further left is never
+ * reached again in that row and a single read of root finds every root.
+ */
+template<int WIDTH, int ROWS>
+struct hysteresisLabels {
+	static const int SLOTS = ROWS + 2;
+	static const int RUNS = WIDTH / 2 + 1;
+	hysteresisPixel line_buf[SLOTS][WIDTH];
+	hysteresisLabel component[SLOTS][RUNS];
+	hysteresisLabel next[SLOTS][RUNS];
+	int runs[SLOTS];
+	hysteresisLink links[WIDTH];
+	uint16_t root[RUNS];
+	bool runStrong[RUNS];
+	bool compStrong[2][RUNS];
+	uint16_t first[RUNS];
+	uint16_t firstRow[RUNS];
+
+	void reset() {
+		for (int s = 0; s < SLOTS; s++)
+			runs[s] = 0;
+		for (int p = 0; p < RUNS; p++) {
+#pragma HLS PIPELINE II=1
+			firstRow[p] = 0;
+		}
+	}
+
+	/* Component in the row in slot of the edge pixel x, if there is one */
+	bool above(int slot, int x, uint16_t &id) {
+		hysteresisPixel p = line_buf[slot][x];
+		id = component[slot][p.run].id;
+		return p.edge;
+	}
+
+	bool keep(int slot, int x) {
+		hysteresisPixel p = line_buf[slot][x];
+		return p.edge && component[slot][p.run].strong;
+	}
+
+	/* Run of row y touches component p of the row above */
+	void merge(int y, uint16_t run, uint16_t p, uint16_t &top, bool &strongTop) {
+		strongTop = strongTop || compStrong[(y + 1) & 1][p];
+		if (firstRow[p] != y + 1) {
+			firstRow[p] = y + 1;
+			first[p] = run;
+			return;
+		}
+		uint16_t j = first[p];
+		uint16_t r = j == run ? top : root[j];
+		if (r == top)
+			return;
+		root[r < top ? top : r] = r < top ? r : top;
+		top = r < top ? r : top;
+	}
 
+	/*
+	 * Closes row y in slot after count runs and n links: one pass over the
+	 * links, two over the runs, one over the components of the row above and
+	 * one over the longest buffered row, all slots at once.
+	 */
+	void endRow(int y, int slot, int above, int count, int n) {
+		const int cur = y & 1;
+		runs[slot] = count;
+
+		int last = -1;
+		uint16_t top = 0;
+		bool strongTop = false;
+		hysLinks:
+		for (int i = 0; i < n; i++) {
+#pragma HLS LOOP_TRIPCOUNT max=WIDTH/2
+			hysteresisLink l = links[i];
+			if (l.run != last) {
+				last = l.run;
+				top = l.run;
+				strongTop = runStrong[l.run];
+			}
+			merge(y, l.run, l.above[0], top, strongTop);
+			if (l.pair)
+				merge(y, l.run, l.above[1], top, strongTop);
+			root[l.run] = top;
+			runStrong[l.run] = strongTop;
+		}
+
+		hysRoots:
+		for (int k = 0; k < count; k++) {
+#pragma HLS LOOP_TRIPCOUNT max=WIDTH/2
+			uint16_t r = root[k];
+			if (r != k)
+				r = root[r];
+			root[k] = r;
+			compStrong[cur][r] = (r != k && compStrong[cur][r]) || runStrong[k];
+		}
+
+		hysRow:
+		for (int k = 0; k < count; k++) {
+#pragma HLS LOOP_TRIPCOUNT max=WIDTH/2
+#pragma HLS PIPELINE II=1
+			hysteresisLabel c;
+			c.id = root[k];
+			c.alive = true;
+			c.strong = compStrong[cur][root[k]];
+			component[slot][k] = c;
+		}
+
+		hysNext:
+		for (int p = 0; p < runs[above]; p++) {
+#pragma HLS LOOP_TRIPCOUNT max=WIDTH/2
+#pragma HLS PIPELINE II=1
+			hysteresisLabel c;
+			c.alive = firstRow[p] == y + 1;
+			c.id = c.alive ? root[first[p]] : 0;
+			c.strong = c.alive && compStrong[cur][c.id];
+			for (int s = 0; s < SLOTS; s++)
+				next[s][p] = c;
+		}
+
+		int longest = 0;
+		for (int s = 0; s < SLOTS; s++)
+			longest = runs[s] > longest ? runs[s] : longest;
+		hysMove:
+		for (int k = 0; k < longest; k++) {
+#pragma HLS LOOP_TRIPCOUNT max=WIDTH/2
+#pragma HLS PIPELINE II=1
+			for (int s = 0; s < SLOTS; s++) {
+				hysteresisLabel c = component[s][k];
+				if (s == slot || k >= runs[s] || !c.alive)
+					continue;
+				hysteresisLabel moved = next[s][c.id];
+				if (!moved.alive)
+					moved.strong = c.strong;
+				component[s][k] = moved;
+			}
+		}
+	}
+};
+
+/*
+ * One row of Hysteresis: takes row y of src from srcAt, if y < rows, and
+ * gives row y - HYSTERESIS_ROWS - 1 of dst from dstAt, if there is one.
+ * Returns the slot of row y + 1.
+ */
 template<int WIDTH, int HEIGHT>
-void Mul(uint8_t *image1, uint8_t *image2, uint16_t *imageOut) {
-	for (int y = 0; y < HEIGHT; y++) {
-		for (int x = 0; x < WIDTH; x++) {
+int hysteresisRow(hysteresisLabels<WIDTH, HYSTERESIS_ROWS> &labels, int y, int slot,
+		const uint8_t* src, int srcAt, uint8_t* dst, int dstAt, uint8_t low, uint8_t high,
+		int rows = HEIGHT, int cols = WIDTH) {
+#pragma HLS INLINE
+	const int ROWS = HYSTERESIS_ROWS;
+	const int SLOTS = ROWS + 2;
+	int above = slot == 0 ? SLOTS - 1 : slot - 1;
+	int oldest = slot == SLOTS - 1 ? 0 : slot + 1;
+	bool hasAbove = y > 0 && y < rows;
+	bool inRun = false;
+	bool strongRun = false;
+	uint16_t run = 0;
+	uint16_t last = 0;
+	int count = 0;
+	int n = 0;
+	uint16_t a0 = 0, a1 = 0, a2 = 0;
+	bool v0 = false, v1 = false;
+	bool v2 = hasAbove && labels.above(above, 0, a2);
+	for (int x = 0; x < cols; x++) {
+#pragma HLS LOOP_TRIPCOUNT max=WIDTH
 #pragma HLS PIPELINE II=1
 #pragma HLS LOOP_FLATTEN off
-			imageOut[x+y*WIDTH] = image1[x+y*WIDTH] * image2[x+y*WIDTH];
+		a0 = a1;
+		v0 = v1;
+		a1 = a2;
+		v1 = v2;
+		v2 = hasAbove && x + 1 < cols && labels.above(above, x + 1, a2);
+		if (y < rows) {
+			uint8_t pix = src[srcAt + x];
+			if (pix >= low) {
+				hysteresisLink l;
+				bool linked;
+				if (!inRun) {
+					run = count++;
+					labels.root[run] = run;
+					strongRun = false;
+					last = labels.RUNS;
+					l.above[0] = v1 ? a1 : v0 ? a0 : a2;
+					l.above[1] = a2;
+					l.pair = !v1 && v0 && v2 && a0 != a2;
+					linked = v0 || v1 || v2;
+				} else {
+					l.above[0] = a2;
+					l.pair = false;
+					linked = v2 && a2 != last;
+				}
+				if (linked) {
+					l.run = run;
+					labels.links[n++] = l;
+					last = l.pair ? l.above[1] : l.above[0];
+				}
+				inRun = true;
+				strongRun = strongRun || pix >= high;
+				labels.runStrong[run] = strongRun;
+				labels.line_buf[slot][x].run = run;
+				labels.line_buf[slot][x].edge = true;
+			} else {
+				labels.line_buf[slot][x].edge = false;
+				inRun = false;
+			}
 		}
+		if (y > ROWS)
+			dst[dstAt + x] = labels.keep(oldest, x) ? 255 : 0;
+	}
+	labels.endRow(y, slot, above, count, n);
+	return oldest;
+}
+
+/**
+ * Two threshold hysteresis in one pass. Pixels from high up are edges,
+ * pixels from low up are edges if they are 8-connected to one through
+ * pixels from low up, in the rows above or at most HYSTERESIS_ROWS rows
+ * below. The output lags the input by HYSTERESIS_ROWS + 1 rows. The pixel
+ * loop takes one pixel per cycle, but the stage does not: the end of a row
+ * does not overlap the next row. With n links and count runs in the row it
+ * takes n + count iterations of the unpipelined hysLinks and hysRoots loops
+ * plus one pipelined pass over the runs of the row, the row above and the
+ * longest buffered row. A row has at most cols links and (cols + 1) / 2
+ * runs, so the worst case, alternating edge pixels on every row, is about
+ *
+ *     cols + L * 3 * cols / 2 + 3 * cols / 2 cycles per row,
+ *
+ * L being the iteration latency of hysLinks / hysRoots in the synthesis
+ * report. That stage then sets the rate of canny's DATAFLOW. Thin Canny
+ * edges give a few runs per row and stay close to cols cycles.
+ */
+template<int WIDTH, int HEIGHT>
+void Hysteresis(hysteresisLabels<WIDTH, HYSTERESIS_ROWS> &labels,
+		uint8_t* src, uint8_t* dst, uint8_t low, uint8_t high, int rows = HEIGHT, int cols = WIDTH) {
+#pragma HLS INLINE
+	const int ROWS = HYSTERESIS_ROWS;
+	labels.reset();
+
+	int slot = 0;
+	hysLoop:
+	for (int y = 0; y < rows + ROWS + 1; y++) {
+#pragma HLS LOOP_TRIPCOUNT max=HEIGHT+HYSTERESIS_ROWS+1
+		slot = hysteresisRow<WIDTH,HEIGHT>(labels, y, slot, src, y * cols,
+				dst, (y - ROWS - 1) * cols, low, high, rows, cols);
 	}
 }
 
 template<int WIDTH, int HEIGHT>
-void Dublicate(uint8_t *imageIn, uint8_t *imageOut1, uint8_t *imageOut2){
-	for (int y = 0; y < HEIGHT; y++) {
-		for (int x = 0; x < WIDTH; x++) {
+void Hysteresis(uint8_t* src, uint8_t* dst, uint8_t low, uint8_t high, int rows = HEIGHT, int cols = WIDTH) {
+	static hysteresisLabels<WIDTH, HYSTERESIS_ROWS> labels;
+#pragma HLS ARRAY_PARTITION variable=labels.line_buf complete dim=1
+#pragma HLS ARRAY_PARTITION variable=labels.component complete dim=1
+#pragma HLS ARRAY_PARTITION variable=labels.next complete dim=1
+#pragma HLS ARRAY_PARTITION variable=labels.runs complete dim=1
+#pragma HLS ARRAY_PARTITION variable=labels.compStrong complete dim=1
+	Hysteresis<WIDTH,HEIGHT>(labels, src, dst, low, high, rows, cols);
+}
+
+template<int WIDTH, int HEIGHT>
+void ZeroBorder(uint8_t* src, uint8_t* dst,int size, int rows = HEIGHT, int cols = WIDTH) {
+
+	borderPadding:
+	for (int y = 0; y < rows; y++) {
+#pragma HLS LOOP_TRIPCOUNT max=HEIGHT
+		for (int x = 0; x < cols; x++) {
+#pragma HLS LOOP_TRIPCOUNT max=WIDTH
+			#pragma HLS PIPELINE II=1
+			#pragma HLS LOOP_FLATTEN off
+			uint8_t pix = src[x + y * cols];
+			if ((size < x && x < cols - size)
+					&& (size < y && y < rows - size)) {
+				dst[x + y * cols] = pix;
+			} else {
+				dst[x + y * cols] = 0;
+			}
+		}
+	}
+}
+
+template<int WIDTH, int HEIGHT, typename T, typename P>
+void Mul(T *image1, T *image2, P *imageOut, int rows = HEIGHT, int cols = WIDTH) {
+	for (int y = 0; y < rows; y++) {
+#pragma HLS LOOP_TRIPCOUNT max=HEIGHT
+		for (int x = 0; x < cols; x++) {
+#pragma HLS LOOP_TRIPCOUNT max=WIDTH
 #pragma HLS PIPELINE II=1
 #pragma HLS LOOP_FLATTEN off
-			imageOut1[x+y*WIDTH] = imageIn[x+y*WIDTH];
-			imageOut2[x+y*WIDTH] = imageIn[x+y*WIDTH];
+			imageOut[x+y*cols] = image1[x+y*cols] * image2[x+y*cols];
 		}
 	}
 }
 
-template<int WIDTH, int HEIGHT>
-void tripleSignal(uint8_t *imageIn, uint8_t *imageOut1, uint8_t *imageOut2,uint8_t *imageOut3){
-	for (int y = 0; y < HEIGHT; y++) {
-		for (int x = 0; x < WIDTH; x++) {
+template<int WIDTH, int HEIGHT, typename T>
+void Dublicate(T *imageIn, T *imageOut1, T *imageOut2, int rows = HEIGHT, int cols = WIDTH){
+	for (int y = 0; y < rows; y++) {
+#pragma HLS LOOP_TRIPCOUNT max=HEIGHT
+		for (int x = 0; x < cols; x++) {
+#pragma HLS LOOP_TRIPCOUNT max=WIDTH
 #pragma HLS PIPELINE II=1
 #pragma HLS LOOP_FLATTEN off
-			imageOut1[x+y*WIDTH] = imageIn[x+y*WIDTH];
-			imageOut2[x+y*WIDTH] = imageIn[x+y*WIDTH];
-			imageOut3[x+y*WIDTH] = imageIn[x+y*WIDTH];
+			imageOut1[x+y*cols] = imageIn[x+y*cols];
+			imageOut2[x+y*cols] = imageIn[x+y*cols];
 		}
 	}
 }
 
-template<int WIDTH, int HEIGHT>
-void ResponseCalc(uint16_t *sobelXX, uint16_t *sobelYY, uint16_t *sobelXY,int32_t *imageOut){
-	//float k = 0.05;//between 0.04-0.06
-	int  k = 2621;//13;
-	//ap_int<12> k = 2621;
+template<int WIDTH, int HEIGHT, typename T>
+void tripleSignal(T *imageIn, T *imageOut1, T *imageOut2,T *imageOut3, int rows = HEIGHT, int cols = WIDTH){
+	for (int y = 0; y < rows; y++) {
+#pragma HLS LOOP_TRIPCOUNT max=HEIGHT
+		for (int x = 0; x < cols; x++) {
+#pragma HLS LOOP_TRIPCOUNT max=WIDTH
+#pragma HLS PIPELINE II=1
+#pragma HLS LOOP_FLATTEN off
+			imageOut1[x+y*cols] = imageIn[x+y*cols];
+			imageOut2[x+y*cols] = imageIn[x+y*cols];
+			imageOut3[x+y*cols] = imageIn[x+y*cols];
+		}
+	}
+}
 
-	for (int y = 0; y < HEIGHT; y++) {
+/*
+ * Weight of tap i of the structure tensor window, box or binomial.
+ */
+inline int tensorTap(int K_SIZE, bool GAUSSIAN, int i) {
+	const int BINOMIAL[4][7] = { { 1, 0, 0, 0, 0, 0, 0 }, { 1, 2, 1, 0, 0, 0, 0 },
+			{ 1, 4, 6, 4, 1, 0, 0 }, { 1, 6, 15, 20, 15, 6, 1 } };
+	return GAUSSIAN ? BINOMIAL[K_SIZE / 2][i] : 1;
+}
+
+/*
+ * Normalises a window sum back to the range of one product. The binomial
+ * weights add up to a power of two, the box uses a reciprocal instead of a
+ * divider and rounds down.
+ */
+template<typename T, typename S>
+inline T tensorNormalise(int K_SIZE, bool GAUSSIAN, S sum) {
+	if (GAUSSIAN)
+		return sum >> (2 * (K_SIZE - 1));
+	int64_t recip = (1 << 24) / (K_SIZE * K_SIZE);
+	return (sum * recip) >> 24;
+}
+
+/*
+ * Windowed sum of one structure tensor product of type T. The box sum keeps
+ * a running sum per column and one along the row, so it costs the same for
+ * every window size. The binomial sum is separable and costs 2*K taps.
+ * Both weight sums stay below 2^(2*(K-1)), which sizes the accumulators.
+ */
+template<int WIDTH, int K_SIZE, bool GAUSSIAN, typename T>
+struct tensorSum {
+	typedef ap_int<CROSS_BITS + 2 * (K_SIZE - 1) + 1> sum_t;
+	T line_buf[K_SIZE][WIDTH];
+	sum_t col_sum[WIDTH];
+	sum_t window_buf[K_SIZE];
+	sum_t row_sum;
+
+	void reset() {
 		for (int x = 0; x < WIDTH; x++) {
+			for (int i = 0; i < K_SIZE; i++)
+				line_buf[i][x] = 0;
+			col_sum[x] = 0;
+		}
+		for (int i = 0; i < K_SIZE; i++)
+			window_buf[i] = 0;
+		row_sum = 0;
+	}
+
+	T step(int x, T v) {
+		T oldest = line_buf[0][x];
+		for (int i = 0; i < K_SIZE - 1; i++)
+			line_buf[i][x] = line_buf[i + 1][x];
+		line_buf[K_SIZE - 1][x] = v;
+
+		sum_t column = 0;
+		if (GAUSSIAN) {
+			for (int i = 0; i < K_SIZE; i++)
+				column += tensorTap(K_SIZE, GAUSSIAN, i) * line_buf[i][x];
+		} else {
+			column = col_sum[x] + v - oldest;
+			col_sum[x] = column;
+		}
+
+		sum_t leaving = window_buf[0];
+		for (int i = 0; i < K_SIZE - 1; i++)
+			window_buf[i] = window_buf[i + 1];
+		window_buf[K_SIZE - 1] = column;
+
+		if (GAUSSIAN) {
+			sum_t sum = 0;
+			for (int i = 0; i < K_SIZE; i++)
+				sum += tensorTap(K_SIZE, GAUSSIAN, i) * window_buf[i];
+			return tensorNormalise<T>(K_SIZE, GAUSSIAN, sum);
+		}
+		row_sum += column - leaving;
+		return tensorNormalise<T>(K_SIZE, GAUSSIAN, row_sum);
+	}
+};
+
+/**
+ * Sums Ix^2, Iy^2 and IxIy over a K_SIZE x K_SIZE window (3, 5 or 7) before
+ * the response is calculated. Like the other window stages the window ends
+ * at the current pixel.
+ */
+template<int WIDTH, int HEIGHT, int K_SIZE, bool GAUSSIAN>
+void TensorWindow(tensorSum<WIDTH, K_SIZE, GAUSSIAN, square_t> &xx,
+		tensorSum<WIDTH, K_SIZE, GAUSSIAN, square_t> &yy,
+		tensorSum<WIDTH, K_SIZE, GAUSSIAN, cross_t> &xy,
+		square_t *sobelXX, square_t *sobelYY, cross_t *sobelXY,
+		square_t *sumXX, square_t *sumYY, cross_t *sumXY, int rows = HEIGHT, int cols = WIDTH) {
+#pragma HLS INLINE
+	xx.reset();
+	yy.reset();
+	xy.reset();
+
+	tensorLoop:
+	for (int y = 0; y < rows; y++) {
+#pragma HLS LOOP_TRIPCOUNT max=HEIGHT
+		for (int x = 0; x < cols; x++) {
+#pragma HLS LOOP_TRIPCOUNT max=WIDTH
+#pragma HLS PIPELINE II=1
+#pragma HLS LOOP_FLATTEN off
+			sumXX[x + y * cols] = xx.step(x, sobelXX[x + y * cols]);
+			sumYY[x + y * cols] = yy.step(x, sobelYY[x + y * cols]);
+			sumXY[x + y * cols] = xy.step(x, sobelXY[x + y * cols]);
+		}
+	}
+}
+
+template<int WIDTH, int HEIGHT, int K_SIZE, bool GAUSSIAN>
+void TensorWindow(square_t *sobelXX, square_t *sobelYY, cross_t *sobelXY,
+		square_t *sumXX, square_t *sumYY, cross_t *sumXY, int rows = HEIGHT, int cols = WIDTH) {
+	static tensorSum<WIDTH, K_SIZE, GAUSSIAN, square_t> xx, yy;
+	static tensorSum<WIDTH, K_SIZE, GAUSSIAN, cross_t> xy;
+#pragma HLS ARRAY_RESHAPE variable=xx.line_buf complete dim=1
+#pragma HLS ARRAY_RESHAPE variable=yy.line_buf complete dim=1
+#pragma HLS ARRAY_RESHAPE variable=xy.line_buf complete dim=1
+#pragma HLS ARRAY_PARTITION variable=xx.window_buf complete dim=0
+#pragma HLS ARRAY_PARTITION variable=yy.window_buf complete dim=0
+#pragma HLS ARRAY_PARTITION variable=xy.window_buf complete dim=0
+	TensorWindow<WIDTH,HEIGHT,K_SIZE,GAUSSIAN>(xx, yy, xy, sobelXX, sobelYY, sobelXY,
+			sumXX, sumYY, sumXY, rows, cols);
+}
+
+/* Harris response of one pixel, exact in the widths above */
+inline response_t responseAt(square_t xx, square_t yy, cross_t xy) {
+	ap_int<DET_BITS> det = xx * yy - xy * xy;
+	ap_uint<SQUARE_BITS + 1> tra = xx + yy;
+	ap_uint<DET_BITS> tra2 = tra * tra;
+	ap_int<DET_BITS> R = det - ((RESPONSE_K * tra2) >> 16);
+	return R >> RESPONSE_SHIFT;
+}
+
+template<int WIDTH, int HEIGHT>
+void ResponseCalc(square_t *sobelXX, square_t *sobelYY, cross_t *sobelXY,response_t *imageOut, int rows = HEIGHT, int cols = WIDTH){
+	for (int y = 0; y < rows; y++) {
+#pragma HLS LOOP_TRIPCOUNT max=HEIGHT
+		for (int x = 0; x < cols; x++) {
+#pragma HLS LOOP_TRIPCOUNT max=WIDTH
 			#pragma HLS PIPELINE II=1
 			#pragma HLS LOOP_FLATTEN off
-			int det = sobelXX[x + y * WIDTH] * sobelYY[x + y * WIDTH]
-					- sobelXY[x + y * WIDTH] * sobelXY[x + y * WIDTH];
-			int tra = sobelXX[x + y * WIDTH] + sobelYY[x + y * WIDTH];
-			int32_t R = det - k* tra * tra;
-			imageOut[x+y*WIDTH] = R >> 16;
+			imageOut[x+y*cols] = responseAt(sobelXX[x + y * cols],
+					sobelYY[x + y * cols], sobelXY[x + y * cols]);
 		}
 	}
 }
 
 template<int WIDTH, int HEIGHT>
-void decide(int32_t *imageIn, weightPixel *imageOut,int low,int high){
+void decide(response_t *imageIn, weightPixel *imageOut,int low,int high, int rows = HEIGHT, int cols = WIDTH){
 
-	for (int y = 0; y < HEIGHT; y++) {
-		for (int x = 0; x < WIDTH; x++) {
+	for (int y = 0; y < rows; y++) {
+#pragma HLS LOOP_TRIPCOUNT max=HEIGHT
+		for (int x = 0; x < cols; x++) {
+#pragma HLS LOOP_TRIPCOUNT max=WIDTH
 #pragma HLS PIPELINE II=1
 #pragma HLS LOOP_FLATTEN off
-			int32_t val = imageIn[x+y*WIDTH];
+			int32_t val = imageIn[x+y*cols];
 			if (val < low){
 				//Edge
-				imageOut[x+y*WIDTH].t = edge;
-				imageOut[x+y*WIDTH].value = (-imageIn[x+y*WIDTH]) >> 8;
+				imageOut[x+y*cols].set(edge, (-imageIn[x+y*cols]) >> 8);
 			}else if(val > high){
-				imageOut[x+y*WIDTH].t = corner;
-				imageOut[x+y*WIDTH].value = imageIn[x+y*WIDTH] >> 8;
+				imageOut[x+y*cols].set(corner, imageIn[x+y*cols] >> 8);
 
 			}else{
-				imageOut[x+y*WIDTH].t = flat;
-				imageOut[x+y*WIDTH].value = 0;
+				imageOut[x+y*cols].set(flat, 0);
 			}
 		}
 	}
 }
 
 template<int WIDTH, int HEIGHT>
-void NonMaxSurpression(weightPixel *imageIn,weightPixel *imageOut){
+void NonMaxSurpression(weightPixel *imageIn,weightPixel *imageOut, int rows = HEIGHT, int cols = WIDTH){
 	const int WINDOW_SIZE = 5;
 
 	weightPixel line_buf[WINDOW_SIZE][WIDTH];
@@ -636,22 +1452,22 @@ void NonMaxSurpression(weightPixel *imageIn,weightPixel *imageOut){
 
 	for(int i=0;i<WINDOW_SIZE;i++){
 		for(int j=0;j<WINDOW_SIZE;j++){
-			window_buf[i][j].t=flat;
-			window_buf[i][j].value=0;
+			window_buf[i][j].set(flat, 0);
 		}
 	}
 	for(int i=0;i<WINDOW_SIZE;i++){
 		for(int j=0;j<WIDTH;j++){
-			line_buf[i][j].t=flat;
-			line_buf[i][j].value=0;
+			line_buf[i][j].set(flat, 0);
 		}
 	}
 
 #pragma HLS ARRAY_RESHAPE variable=line_buf complete dim=1
 #pragma HLS ARRAY_PARTITION variable=window_buf complete dim=0
 
-	for (int y = 0; y < HEIGHT; y++) {
-		for (int x = 0; x < WIDTH; x++) {
+	for (int y = 0; y < rows; y++) {
+#pragma HLS LOOP_TRIPCOUNT max=HEIGHT
+		for (int x = 0; x < cols; x++) {
+#pragma HLS LOOP_TRIPCOUNT max=WIDTH
 			#pragma HLS PIPELINE II=1
 			#pragma HLS LOOP_FLATTEN off
 
@@ -659,7 +1475,7 @@ void NonMaxSurpression(weightPixel *imageIn,weightPixel *imageOut){
 				line_buf[i][x] = line_buf[i + 1][x];
 
 
-			line_buf[WINDOW_SIZE - 1][x] = imageIn[x + y * WIDTH];
+			line_buf[WINDOW_SIZE - 1][x] = imageIn[x + y * cols];
 
 			for (int y2 = 0; y2 < WINDOW_SIZE; y2++) {
 				for (int x2 = 0; x2 < WINDOW_SIZE - 1; x2++) {
@@ -671,77 +1487,470 @@ void NonMaxSurpression(weightPixel *imageIn,weightPixel *imageOut){
 				window_buf[i][WINDOW_SIZE - 1] = line_buf[i][x];
 
 			uint16_t max=0;
-			if (window_buf[WINDOW_SIZE/2][WINDOW_SIZE/2].t==corner){
+			if (window_buf[WINDOW_SIZE/2][WINDOW_SIZE/2].t()==corner){
 				for (int xw = 0; xw < WINDOW_SIZE; xw++) {
 					for (int yw = 0; yw < WINDOW_SIZE; yw++) {
 						weightPixel tmp = window_buf[xw][yw];
-						if(tmp.t==corner && tmp.value>max)
-							max = tmp.value;
+						if(tmp.t()==corner && tmp.value()>max)
+							max = tmp.value();
 					}
 				}
-				if (window_buf[WINDOW_SIZE/2][WINDOW_SIZE/2].value==max){
-					imageOut[x+y*WIDTH].t=corner;
-					imageOut[x+y*WIDTH].value = max;
+				if (window_buf[WINDOW_SIZE/2][WINDOW_SIZE/2].value()==max){
+					imageOut[x+y*cols].set(corner, max);
 				}else{
 					//std::cout <<"Set to 0 \n";
-					imageOut[x+y*WIDTH].t=flat;
-					imageOut[x+y*WIDTH].value = 0;
+					imageOut[x+y*cols].set(flat, 0);
 				}
 
 			}else{
-				imageOut[x+y*WIDTH].t=imageIn[x + y * WIDTH].t;
-				imageOut[x+y*WIDTH].value = imageIn[x + y * WIDTH].value;
+				imageOut[x+y*cols] = imageIn[x + y * cols];
+			}
+
+		}
+	}
+}
+
+/*
+ * Bounded min-heap of the strongest corners seen so far. The weakest kept
+ * corner sits at the root, so a new corner only has to beat item[0]. A sift
+ * moves at most one level per step, so DEPTH steps always reach a leaf and
+ * every push or pop takes the same number of steps.
+ */
+template<int N>
+struct cornerHeap {
+	static const int DEPTH = bitsFor<N>::value;
+	cornerRecord item[N];
+	int size;
+
+	void clear() {
+		size = 0;
+	}
+
+	void siftDown(int i) {
+		siftDownLoop: for (int step = 0; step < DEPTH; step++) {
+			int l = 2 * i + 1;
+			int r = l + 1;
+			int m = i;
+			if (l < size && item[l].score < item[m].score)
+				m = l;
+			if (r < size && item[r].score < item[m].score)
+				m = r;
+			if (m != i) {
+				cornerRecord tmp = item[i];
+				item[i] = item[m];
+				item[m] = tmp;
+				i = m;
+			}
+		}
+	}
+
+	void push(cornerRecord c) {
+		if (size < N) {
+			int i = size++;
+			item[i] = c;
+			siftUpLoop: for (int step = 0; step < DEPTH; step++) {
+				int p = i > 0 ? (i - 1) / 2 : 0;
+				if (item[p].score > item[i].score) {
+					cornerRecord tmp = item[i];
+					item[i] = item[p];
+					item[p] = tmp;
+					i = p;
+				}
 			}
+		} else if (c.score > item[0].score) {
+			item[0] = c;
+			siftDown(0);
+		}
+	}
 
+	/* Empties the heap into out, strongest corner first */
+	int drain(cornerRecord *out) {
+		int n = size;
+		drainLoop: for (int k = n - 1; k >= 0; k--) {
+#pragma HLS LOOP_TRIPCOUNT max=N
+			out[k] = item[0];
+			item[0] = item[--size];
+			siftDown(0);
 		}
+		return n;
 	}
+};
+
+/*
+ * A corner on its way from a pixel loop to the heaps of TopCorners. flush
+ * writes out the heaps of the current row of cells, end does the same and
+ * closes the list.
+ */
+struct cornerCandidate {
+	cornerRecord record;
+	uint8_t cell;
+	bool flush;
+	bool end;
+};
+
+inline cornerCandidate candidateOf(cornerRecord c, int cell) {
+	cornerCandidate k;
+	k.record = c;
+	k.cell = cell;
+	k.flush = false;
+	k.end = false;
+	return k;
+}
+
+inline cornerCandidate candidateMark(bool end) {
+	cornerCandidate k;
+	k.record.x = 0;
+	k.record.y = 0;
+	k.record.score = 0;
+	k.record.level = 0;
+	k.record.last = false;
+	k.cell = 0;
+	k.flush = !end;
+	k.end = end;
+	return k;
+}
+
+/* Appends the record with last set behind the n corners of a list */
+inline void closeCornerList(cornerRecord *listOut, int n, uint16_t &count) {
+	cornerRecord end;
+	end.x = 0;
+	end.y = 0;
+	end.score = 0;
+	end.level = 0;
+	end.last = true;
+	listOut[n] = end;
+	count = n;
+}
+
+/**
+ * Keeps the K strongest candidates of every cell of the current row of cells
+ *
+ * Runs beside the pixel loop that writes the candidates, so a heap update,
+ * which takes a few cycles per level, never holds up a pixel. A burst of
+ * corners waits in the candidate FIFO. On flush the heaps of the first cells
+ * cells are written to the list, every cell strongest first, end does the
+ * same and appends the record with last set.
+ */
+template<int K, int CELLS>
+void TopCorners(hls::stream<cornerCandidate> &candidates, cornerRecord *listOut, uint16_t &count, int cells = CELLS){
+	static cornerHeap<K> heap[CELLS];
+	int n = 0;
+
+	clearLoop: for (int c = 0; c < CELLS; c++)
+		heap[c].clear();
+
+	bool end = false;
+	topCornersLoop: while (!end) {
+#pragma HLS LOOP_TRIPCOUNT max=MAX_WIDTH*MAX_HEIGHT/9
+		cornerCandidate k = candidates.read();
+		end = k.end;
+		if (k.flush || k.end) {
+			drainCells: for (int c = 0; c < cells; c++) {
+#pragma HLS LOOP_TRIPCOUNT max=CELLS
+				n += heap[c].drain(listOut + n);
+			}
+		} else {
+			heap[k.cell].push(k.record);
+		}
+	}
+
+	closeCornerList(listOut, n, count);
 }
 
+/*
+ * Pixel loop of CornerList and GridCornerList. Writes every corner of the
+ * dense frame as a candidate tagged with its column of cells, a flush once
+ * the last row of a row of cells has passed and end after the frame.
+ */
 template<int WIDTH, int HEIGHT>
-void MinMax(int32_t *imageIn, int32_t *imageOut, int32_t &max) {
-	for (int y = 0; y < HEIGHT; y++) {
-		for (int x = 0; x < WIDTH; x++) {
+void CornerCandidates(weightPixel *imageIn, hls::stream<cornerCandidate> &candidates, int cellWidth, int cellHeight, int rows, int cols){
+	int cellRow = 0;
+
+	for (int y = 0; y < rows; y++) {
+#pragma HLS LOOP_TRIPCOUNT max=HEIGHT
+		int cell = 0;
+		int edge = cellWidth;
+		for (int x = 0; x < cols; x++) {
+#pragma HLS LOOP_TRIPCOUNT max=WIDTH
+#pragma HLS PIPELINE II=1
+#pragma HLS LOOP_FLATTEN off
+			if (x == edge) {
+				cell++;
+				edge += cellWidth;
+			}
+			weightPixel px = imageIn[x + y * cols];
+			if (px.t() == corner) {
+				cornerRecord c;
+				c.x = x;
+				c.y = y;
+				c.score = px.value();
+				c.level = 0;
+				c.last = false;
+				candidates.write(candidateOf(c, cell));
+			}
+		}
+		if (y == rows - 1) {
+			candidates.write(candidateMark(true));
+		} else if (++cellRow == cellHeight) {
+			cellRow = 0;
+			candidates.write(candidateMark(false));
+		}
+	}
+}
+
+/**
+ * Sparse output of the N strongest corners of a frame
+ *
+ * Writes one record per corner, strongest first, followed by a record with
+ * last set. The coordinates are the ones of the dense weightPixel frame.
+ */
+template<int WIDTH, int HEIGHT, int N>
+void CornerList(weightPixel *imageIn, cornerRecord *listOut, uint16_t &count, int rows = HEIGHT, int cols = WIDTH){
+#pragma HLS DATAFLOW
+	static hls::stream<cornerCandidate> candidates;
+#pragma HLS STREAM variable=candidates depth=CANDIDATE_DEPTH
+
+	CornerCandidates<WIDTH,HEIGHT>(imageIn, candidates, cols, rows, rows, cols);
+	TopCorners<N,1>(candidates, listOut, count);
+}
+
+/**
+ * Sparse output of the K strongest corners of every cell of a grid
+ *
+ * The frame is cut into gridCols x gridRows cells, at most GX x GY. Every
+ * cell of the current row of cells has its own heap, which is written out
+ * once the last row of the cell has passed. The list holds the cells in
+ * raster order, each strongest first, followed by a record with last set.
+ */
+template<int WIDTH, int HEIGHT, int GX, int GY, int K>
+void GridCornerList(weightPixel *imageIn, cornerRecord *listOut, uint16_t &count, int gridCols = GX, int gridRows = GY, int rows = HEIGHT, int cols = WIDTH){
+#pragma HLS DATAFLOW
+	static hls::stream<cornerCandidate> candidates;
+#pragma HLS STREAM variable=candidates depth=CANDIDATE_DEPTH
+	if (gridCols < 1)
+		gridCols = 1;
+	if (gridCols > GX)
+		gridCols = GX;
+	if (gridRows < 1)
+		gridRows = 1;
+	if (gridRows > GY)
+		gridRows = GY;
+	const int cellWidth = (cols + gridCols - 1) / gridCols;
+	const int cellHeight = (rows + gridRows - 1) / gridRows;
+
+	CornerCandidates<WIDTH,HEIGHT>(imageIn, candidates, cellWidth, cellHeight, rows, cols);
+	TopCorners<K,GX>(candidates, listOut, count, gridCols);
+}
+
+/**
+ * Passes a frame through and publishes how many of its pixels have passed
+ *
+ * progress is written after every pixel. On an s_axilite port the register
+ * follows it while the frame runs, so with ap_ctrl_none, where a stalled
+ * frame never writes its status, the stage that stopped can still be found.
+ */
+template<int WIDTH, int HEIGHT>
+void PixelProgress(RGB_IMAGE &imageIn, RGB_IMAGE &imageOut, volatile uint32_t &progress, int rows = HEIGHT, int cols = WIDTH){
+	hls::Scalar<3,uint8_t> pixel_value;
+	uint32_t pixels = 0;
+
+	for (int y = 0; y < rows; y++) {
+#pragma HLS LOOP_TRIPCOUNT max=HEIGHT
+		for (int x = 0; x < cols; x++) {
+#pragma HLS LOOP_TRIPCOUNT max=WIDTH
+#pragma HLS PIPELINE II=1
+#pragma HLS LOOP_FLATTEN off
+			imageIn >> pixel_value;
+			imageOut << pixel_value;
+			progress = ++pixels;
+		}
+	}
+}
+
+template<int WIDTH, int HEIGHT, typename T>
+void PixelProgress(T *imageIn, T *imageOut, volatile uint32_t &progress, int rows = HEIGHT, int cols = WIDTH){
+	uint32_t pixels = 0;
+
+	for (int y = 0; y < rows; y++) {
+#pragma HLS LOOP_TRIPCOUNT max=HEIGHT
+		for (int x = 0; x < cols; x++) {
+#pragma HLS LOOP_TRIPCOUNT max=WIDTH
 #pragma HLS PIPELINE II=1
 #pragma HLS LOOP_FLATTEN off
-			int32_t tmp = imageIn[x + y * WIDTH];
+			imageOut[x + y * cols] = imageIn[x + y * cols];
+			progress = ++pixels;
+		}
+	}
+}
+
+/**
+ * Passes a frame of the detector through and counts it into status
+ *
+ * progress is the live counter of the pixels that left the detector in the
+ * current frame, see PixelProgress. status is written at the end of the frame.
+ */
+template<int WIDTH, int HEIGHT>
+void FrameStatus(weightPixel *imageIn, weightPixel *imageOut, harrisStatus &status, volatile uint32_t &progress, int rows = HEIGHT, int cols = WIDTH){
+	static uint32_t frames = 0;
+	uint32_t pixels = 0;
+	uint32_t corners = 0;
+	uint32_t edges = 0;
+	uint16_t peak = 0;
+
+	for (int y = 0; y < rows; y++) {
+#pragma HLS LOOP_TRIPCOUNT max=HEIGHT
+		for (int x = 0; x < cols; x++) {
+#pragma HLS LOOP_TRIPCOUNT max=WIDTH
+#pragma HLS PIPELINE II=1
+#pragma HLS LOOP_FLATTEN off
+			weightPixel px = imageIn[x + y * cols];
+			if (px.t() == corner) {
+				corners++;
+				if (px.value() > peak)
+					peak = px.value();
+			} else if (px.t() == edge) {
+				edges++;
+			}
+			imageOut[x + y * cols] = px;
+			progress = ++pixels;
+		}
+	}
+
+	frames++;
+	status.frames = frames;
+	status.pixels = pixels;
+	status.corners = corners;
+	status.edges = edges;
+	status.peak = peak;
+}
+
+template<int WIDTH, int HEIGHT>
+void MinMax(response_t *imageIn, response_t *imageOut, int32_t &max, int rows = HEIGHT, int cols = WIDTH) {
+	for (int y = 0; y < rows; y++) {
+#pragma HLS LOOP_TRIPCOUNT max=HEIGHT
+		for (int x = 0; x < cols; x++) {
+#pragma HLS LOOP_TRIPCOUNT max=WIDTH
+#pragma HLS PIPELINE II=1
+#pragma HLS LOOP_FLATTEN off
+			int32_t tmp = imageIn[x + y * cols];
 			if (tmp > max)
 				max = tmp;
-			imageOut[x + y * WIDTH] = tmp;
+			imageOut[x + y * cols] = tmp;
 		}
 
 	}
 }
 
+/*
+ * Histogram of the positive responses of a frame. Bins 0 to 3 hold the
+ * values 0 to 3, above that every power of two is split into four bins, so
+ * the whole range of response_t fits in a few dozen counters.
+ */
+const int HISTOGRAM_BINS = 4 * (RESPONSE_BITS - 2);
+
+inline int histogramBin(int32_t R) {
+	int e = 0;
+	msbLoop: for (int b = 2; b < RESPONSE_BITS - 1; b++)
+		if ((R >> b) != 0)
+			e = b;
+	if (e == 0)
+		return R;
+	return 4 * (e - 1) + ((R >> (e - 2)) & 3);
+}
+
+/* Smallest response that falls into bin b */
+inline int32_t histogramEdge(int b) {
+	if (b < 4)
+		return b;
+	return (int32_t) (4 + (b & 3)) << (b / 4 - 1);
+}
+
+struct responseHistogram {
+	uint32_t bin[HISTOGRAM_BINS];
+
+	void clear() {
+		for (int b = 0; b < HISTOGRAM_BINS; b++)
+			bin[b] = 0;
+	}
+
+	void add(int32_t R) {
+		if (R > 0)
+			bin[histogramBin(R)]++;
+	}
+
+	/*
+	 * The high threshold of decide at the lowest bin edge that lets
+	 * through at most target responses.
+	 */
+	int32_t threshold(uint32_t target) {
+		uint32_t sum = 0;
+		int32_t high = 0x7FFFFFFF;
+		thresholdLoop: for (int b = HISTOGRAM_BINS - 1; b > 0; b--) {
+			uint32_t next = sum + bin[b];
+			if (next > target)
+				break;
+			sum = next;
+			high = histogramEdge(b) - 1;
+		}
+		return high;
+	}
+};
+
 /**
- * Harris Corner detector
+ * MinMax that also counts the responses into hist, for a threshold that
+ * targets a corner count instead of a distance to the maximum
+ */
+template<int WIDTH, int HEIGHT>
+void MinMaxHistogram(response_t *imageIn, response_t *imageOut, int32_t &max, responseHistogram &hist, int rows = HEIGHT, int cols = WIDTH) {
+	hist.clear();
+	for (int y = 0; y < rows; y++) {
+#pragma HLS LOOP_TRIPCOUNT max=HEIGHT
+		for (int x = 0; x < cols; x++) {
+#pragma HLS LOOP_TRIPCOUNT max=WIDTH
+#pragma HLS PIPELINE II=1
+#pragma HLS LOOP_FLATTEN off
+			int32_t tmp = imageIn[x + y * cols];
+			if (tmp > max)
+				max = tmp;
+			hist.add(tmp);
+			imageOut[x + y * cols] = tmp;
+		}
+	}
+}
+
+/**
+ * Harris Corner detector on a grayscale frame
  *
+ * With a target above 0 the corner threshold comes from the response
+ * histogram of the frame, so that at most target responses pass decide,
+ * instead of from max - thresUp.
  */
 template<int WIDTH, int HEIGHT>
-void harris(RGB_IMAGE &src, weightPixel *dst,int thresUp){
+void harrisGray(uint8_t *gray, weightPixel *dst,int thresUp, int rows = HEIGHT, int cols = WIDTH, int target = 0){
 
 #pragma HLS DATAFLOW
-	static uint8_t 		fifo1[WIDTH*HEIGHT*3];
 	static uint8_t 		fifo2[WIDTH*HEIGHT];
 	static uint8_t 		fifo3[WIDTH*HEIGHT];
 	static uint8_t 		fifo4[WIDTH*HEIGHT];
-	static uint8_t 		SobelXFIFO[WIDTH*HEIGHT];
-	static uint8_t 		SobelYFIFO[WIDTH*HEIGHT];
-	static uint8_t 		fifo5[WIDTH*HEIGHT];
-	static uint8_t 		fifo6[WIDTH*HEIGHT];
-	static uint8_t 		fifo7[WIDTH*HEIGHT];
-	static uint8_t 		fifo8[WIDTH*HEIGHT];
-	static uint8_t 		fifo9[WIDTH*HEIGHT];
-	static uint8_t 		fifoA[WIDTH*HEIGHT];
-	static uint16_t 	SobelXX[WIDTH*HEIGHT];
-	static uint16_t 	SobelYY[WIDTH*HEIGHT];
-	static uint16_t 	SobelXY[WIDTH*HEIGHT];
-	static int32_t 		Response[WIDTH*HEIGHT];
+	static gradient_t 	SobelXFIFO[WIDTH*HEIGHT];
+	static gradient_t 	SobelYFIFO[WIDTH*HEIGHT];
+	static gradient_t 	fifo5[WIDTH*HEIGHT];
+	static gradient_t 	fifo6[WIDTH*HEIGHT];
+	static gradient_t 	fifo7[WIDTH*HEIGHT];
+	static gradient_t 	fifo8[WIDTH*HEIGHT];
+	static gradient_t 	fifo9[WIDTH*HEIGHT];
+	static gradient_t 	fifoA[WIDTH*HEIGHT];
+	static square_t 	SobelXX[WIDTH*HEIGHT];
+	static square_t 	SobelYY[WIDTH*HEIGHT];
+	static cross_t 		SobelXY[WIDTH*HEIGHT];
+	static response_t 	Response[WIDTH*HEIGHT];
 	static weightPixel  harris[WIDTH*HEIGHT];
-	static int32_t  	min_max[WIDTH*HEIGHT];
+	static response_t  	min_max[WIDTH*HEIGHT];
+	responseHistogram	hist;
+#pragma HLS ARRAY_PARTITION variable=hist.bin complete dim=1
 
-	int max=0;
+	int32_t max=0;
 
-#pragma HLS STREAM variable=fifo1 depth=1 dim=1
 #pragma HLS STREAM variable=fifo2 depth=1 dim=1
 #pragma HLS STREAM variable=fifo3 depth=1 dim=1
 #pragma HLS STREAM variable=fifo4 depth=1 dim=1
@@ -760,29 +1969,669 @@ void harris(RGB_IMAGE &src, weightPixel *dst,int thresUp){
 #pragma HLS STREAM variable=min_max depth=1 dim=1
 #pragma HLS STREAM variable=harris depth=1 dim=1
 
-	MatToGrayArray<WIDTH,HEIGHT>(src,fifo1);
-	Gauss3<WIDTH,HEIGHT>(fifo1,fifo2);
-	Dublicate<WIDTH,HEIGHT>(fifo2,fifo3,fifo4);
-	SobelY<WIDTH,HEIGHT>(fifo3,SobelYFIFO);
-	SobelX<WIDTH,HEIGHT>(fifo4,SobelXFIFO);
-	tripleSignal<WIDTH,HEIGHT>(SobelXFIFO,fifo5,fifo6,fifo7);
-	tripleSignal<WIDTH,HEIGHT>(SobelYFIFO,fifo8,fifo9,fifoA);
-	Mul<WIDTH,HEIGHT>(fifo5,fifo6,SobelXX);
-	Mul<WIDTH,HEIGHT>(fifo8,fifo9,SobelYY);
-	Mul<WIDTH,HEIGHT>(fifo7,fifoA,SobelXY);
-	ResponseCalc<WIDTH,HEIGHT>(SobelXX,SobelYY,SobelXY,Response);
-	MinMax<WIDTH,HEIGHT>(Response,min_max,max);
-	decide<WIDTH,HEIGHT>(min_max,harris,42,max-thresUp);
-	NonMaxSurpression<WIDTH,HEIGHT>(harris,dst);
+	const int n = rows * cols;
+	(void) n;
+
+	HARRIS_STAGE(stageGauss, n, n, Gauss3<WIDTH,HEIGHT>(gray,fifo2,rows,cols));
+	HARRIS_STAGE(stageGauss, n, 2*n, Dublicate<WIDTH,HEIGHT>(fifo2,fifo3,fifo4,rows,cols));
+	HARRIS_STAGE(stageSobel, n, n, SobelY<WIDTH,HEIGHT>(fifo3,SobelYFIFO,rows,cols));
+	HARRIS_STAGE(stageSobel, n, n, SobelX<WIDTH,HEIGHT>(fifo4,SobelXFIFO,rows,cols));
+	HARRIS_STAGE(stageSobel, n, 3*n, tripleSignal<WIDTH,HEIGHT>(SobelXFIFO,fifo5,fifo6,fifo7,rows,cols));
+	HARRIS_STAGE(stageSobel, n, 3*n, tripleSignal<WIDTH,HEIGHT>(SobelYFIFO,fifo8,fifo9,fifoA,rows,cols));
+	HARRIS_STAGE(stageMul, 2*n, n, Mul<WIDTH,HEIGHT>(fifo5,fifo6,SobelXX,rows,cols));
+	HARRIS_STAGE(stageMul, 2*n, n, Mul<WIDTH,HEIGHT>(fifo8,fifo9,SobelYY,rows,cols));
+	HARRIS_STAGE(stageMul, 2*n, n, Mul<WIDTH,HEIGHT>(fifo7,fifoA,SobelXY,rows,cols));
+#if TENSOR_WINDOW > 1
+	static square_t 	SumXX[WIDTH*HEIGHT];
+	static square_t 	SumYY[WIDTH*HEIGHT];
+	static cross_t 		SumXY[WIDTH*HEIGHT];
+#pragma HLS STREAM variable=SumXX depth=1 dim=1
+#pragma HLS STREAM variable=SumYY depth=1 dim=1
+#pragma HLS STREAM variable=SumXY depth=1 dim=1
+	HARRIS_STAGE(stageTensor, 3*n, 3*n, TensorWindow<WIDTH,HEIGHT,TENSOR_WINDOW,TENSOR_GAUSSIAN>(SobelXX,SobelYY,SobelXY,SumXX,SumYY,SumXY,rows,cols));
+	HARRIS_STAGE(stageResponse, 3*n, n, ResponseCalc<WIDTH,HEIGHT>(SumXX,SumYY,SumXY,Response,rows,cols));
+#else
+	HARRIS_STAGE(stageResponse, 3*n, n, ResponseCalc<WIDTH,HEIGHT>(SobelXX,SobelYY,SobelXY,Response,rows,cols));
+#endif
+	HARRIS_STAGE(stageMinMax, n, n, MinMaxHistogram<WIDTH,HEIGHT>(Response,min_max,max,hist,rows,cols));
+	HARRIS_STAGE(stageDecide, n, n, decide<WIDTH,HEIGHT>(min_max,harris,42,target > 0 ? hist.threshold(target) : max-thresUp,rows,cols));
+	HARRIS_STAGE(stageSuppress, n, n, NonMaxSurpression<WIDTH,HEIGHT>(harris,dst,rows,cols));
+	HARRIS_FRAME(dst, n);
+
+}
+
+/**
+ * Harris Corner detector
+ *
+ */
+template<int WIDTH, int HEIGHT>
+void harris(RGB_IMAGE &src, weightPixel *dst,int thresUp, int rows = HEIGHT, int cols = WIDTH, int target = 0){
+
+#pragma HLS DATAFLOW
+	static uint8_t 		fifo1[WIDTH*HEIGHT];
+#pragma HLS STREAM variable=fifo1 depth=1 dim=1
+
+	HARRIS_STAGE(stageGray, rows * cols, rows * cols, MatToGrayArray<WIDTH,HEIGHT>(src,fifo1,rows,cols));
+	harrisGray<WIDTH,HEIGHT>(fifo1,dst,thresUp,rows,cols,target);
+}
+
+/*
+ * Per pixel arithmetic of the single stages above. The fused kernels use
+ * these so they produce exactly what the stage chain produces.
+ */
+inline uint8_t grayPixel(hls::Scalar<3,uint8_t> &pixel_value) {
+	uint8_t red = (pixel_value.val[0] * 77) >> 8;			//*0.299
+	uint8_t green = (pixel_value.val[1] * 150) >> 8;		//*0.587
+	uint8_t blue = (pixel_value.val[2] * 28) >> 8;			//0.114
+	return red + green + blue;
+}
+
+/**
+ * Grayscale frame straight from a mono, YUV422 or Bayer stream, see
+ * rawFormat. Only the luma crosses the interface, a quarter of the RGB
+ * beats for mono and half for YUV422. rows and cols give the size of the
+ * grayscale frame.
+ */
+template<int WIDTH, int HEIGHT>
+void RawToGrayArray(AXI_STREAM &in, uint8_t *out, int format, int rows = HEIGHT, int cols = WIDTH) {
+	ap_axiu<32,1,1,1> beat;
+
+	waitStart: do {
+#pragma HLS LOOP_TRIPCOUNT max=1
+		in >> beat;
+	} while (!beat.user);
+
+	if (format == rawBayerGreen || format == rawBayerLuma) {
+		/* red and first green of every quad, from the even mosaic row */
+		static uint8_t quad_buf[2][WIDTH+1];
+#pragma HLS ARRAY_PARTITION variable=quad_buf complete dim=1
+#pragma HLS ARRAY_PARTITION variable=quad_buf cyclic factor=2 dim=2
+		hls::Scalar<3,uint8_t> pixel_value;
+		const int beats = (cols + 1) / 2;
+
+		bayerLoop: for (int y = 0; y < rows; y++) {
+#pragma HLS LOOP_TRIPCOUNT max=HEIGHT
+			for (int x = 0; x < beats; x++) {
+#pragma HLS LOOP_TRIPCOUNT max=WIDTH/2
+#pragma HLS loop_flatten off
+#pragma HLS pipeline II=1
+				if (x != 0 || y != 0)
+					in >> beat;
+				for (int j = 0; j < 2; j++) {
+					quad_buf[0][2 * x + j] = beat.data.range(16 * j + 7, 16 * j);
+					quad_buf[1][2 * x + j] = beat.data.range(16 * j + 15, 16 * j + 8);
+				}
+			}
+			for (int x = 0; x < cols; x++) {
+#pragma HLS LOOP_TRIPCOUNT max=WIDTH
+#pragma HLS loop_flatten off
+#pragma HLS pipeline II=1
+				int j = x & 1;
+				if (j == 0)
+					in >> beat;
+				uint8_t green = (quad_buf[1][x] + beat.data.range(16 * j + 7, 16 * j)) >> 1;
+				if (format == rawBayerGreen) {
+					out[x + y * cols] = green;
+				} else {
+					pixel_value.val[0] = quad_buf[0][x];
+					pixel_value.val[1] = green;
+					pixel_value.val[2] = beat.data.range(16 * j + 15, 16 * j + 8);
+					out[x + y * cols] = grayPixel(pixel_value);
+				}
+			}
+		}
+	} else {
+		const int step = format == rawMono ? 4 : 2;
+		const int lane = format == rawMono ? 8 : 16;
+
+		packedLoop: for (int y = 0; y < rows; y++) {
+#pragma HLS LOOP_TRIPCOUNT max=HEIGHT
+			int k = 0;
+			for (int x = 0; x < cols; x++) {
+#pragma HLS LOOP_TRIPCOUNT max=WIDTH
+#pragma HLS loop_flatten off
+#pragma HLS pipeline II=1
+				if (k == step)
+					k = 0;
+				if (k == 0 && (x != 0 || y != 0))
+					in >> beat;
+				out[x + y * cols] = beat.data.range(lane * k + 7, lane * k);
+				k++;
+			}
+		}
+	}
+}
+
+template<typename WIN>
+inline uint8_t gauss3At(WIN &window_buf, int c) {
+	return convolveAt<gauss3Kernel>(window_buf, c);
+}
+
+template<typename WIN>
+inline gradient_t sobelXAt(WIN &window_buf, int c) {
+	return convolveAt<sobelXKernel>(window_buf, c);
+}
+
+template<typename WIN>
+inline gradient_t sobelYAt(WIN &window_buf, int c) {
+	return convolveAt<sobelYKernel>(window_buf, c);
+}
+
+template<typename WIN>
+inline uint8_t gauss5At(WIN &window_buf, int c) {
+	return convolveAt<gauss5Kernel>(window_buf, c);
+}
+
+inline weightPixel decideAt(int32_t val, int low, int high) {
+	weightPixel out;
+	if (val < low){
+		out.set(edge, (-val) >> 8);
+	}else if(val > high){
+		out.set(corner, val >> 8);
+	}else{
+		out.set(flat, 0);
+	}
+	return out;
+}
+
+/*
+ * NonMaxSurpression of the 5x5 window that starts at column c. cur is the
+ * newest pixel of the window, it passes unchanged if the centre is no corner.
+ */
+template<typename WIN>
+inline weightPixel suppressAt(WIN &window_buf, int c, weightPixel cur) {
+	weightPixel center = window_buf[2][c + 2];
+	if (center.t() != corner)
+		return cur;
+
+	uint16_t max = 0;
+	for (int yw = 0; yw < 5; yw++) {
+		for (int xw = 0; xw < 5; xw++) {
+			weightPixel tmp = window_buf[yw][c + xw];
+			if (tmp.t() == corner && tmp.value() > max)
+				max = tmp.value();
+		}
+	}
+	weightPixel out;
+	if (center.value() == max) {
+		out.set(corner, max);
+	} else {
+		out.set(flat, 0);
+	}
+	return out;
+}
+
+/*
+ * Gray and blurred pixel of one position in the fused front end
+ */
+struct fusedTap {
+	uint8_t gray;
+	uint8_t blur;
+};
+
+/*
+ * One column of the shared line buffer: the two rows of gray and blurred
+ * pixels above the current one and the four rows of decided pixels the
+ * suppression needs, oldest first.
+ */
+struct fusedColumn {
+	fusedTap tap[2];
+	weightPixel decided[4];
+};
+
+/*
+ * Rolling window of the fused detector. Blur, gradient, decide and the 5x5
+ * suppression all take their rows from one line buffer entry per column,
+ * so every pixel costs one read and one write of it.
+ */
+template<int WIDTH>
+struct harrisFrontEnd {
+	fusedColumn line_buf[WIDTH];
+	fusedTap window_buf[3][3];
+	weightPixel nms_buf[5][5];
+#if TENSOR_WINDOW > 1
+	tensorSum<WIDTH, TENSOR_WINDOW, TENSOR_GAUSSIAN, square_t> sumXX, sumYY;
+	tensorSum<WIDTH, TENSOR_WINDOW, TENSOR_GAUSSIAN, cross_t> sumXY;
+#endif
+
+	void reset() {
+		fusedTap zero = { 0, 0 };
+		weightPixel none;
+		none.set(flat, 0);
+#if TENSOR_WINDOW > 1
+		sumXX.reset();
+		sumYY.reset();
+		sumXY.reset();
+#endif
+		for (int i = 0; i < 3; i++)
+			for (int j = 0; j < 3; j++)
+				window_buf[i][j] = zero;
+		for (int i = 0; i < 5; i++)
+			for (int j = 0; j < 5; j++)
+				nms_buf[i][j] = none;
+		for (int x = 0; x < WIDTH; x++) {
+			for (int i = 0; i < 2; i++)
+				line_buf[x].tap[i] = zero;
+			for (int i = 0; i < 4; i++)
+				line_buf[x].decided[i] = none;
+		}
+	}
+
+	/*
+	 * Gray -> Gauss3 -> SobelX/SobelY -> Mul -> TensorWindow -> ResponseCalc
+	 * -> decide -> NonMaxSurpression for one pixel. R is the response of the
+	 * pixel, the result is what NonMaxSurpression gives at column x.
+	 */
+	weightPixel step(int x, uint8_t gray, int32_t high, int32_t &R) {
+		uint8_t gray_win[3][3];
+		uint8_t blur_win[3][3];
+#pragma HLS ARRAY_PARTITION variable=gray_win complete dim=0
+#pragma HLS ARRAY_PARTITION variable=blur_win complete dim=0
+
+		fusedColumn column = line_buf[x];
+
+		for (int yw = 0; yw < 3; yw++) {
+			for (int xw = 0; xw < 2; xw++) {
+				window_buf[yw][xw] = window_buf[yw][xw + 1];
+			}
+		}
+		window_buf[0][2] = column.tap[0];
+		window_buf[1][2] = column.tap[1];
+		window_buf[2][2].gray = gray;
+
+		for (int yw = 0; yw < 3; yw++) {
+			for (int xw = 0; xw < 3; xw++) {
+				gray_win[yw][xw] = window_buf[yw][xw].gray;
+			}
+		}
+		window_buf[2][2].blur = gauss3At(gray_win, 0);
+
+		for (int yw = 0; yw < 3; yw++) {
+			for (int xw = 0; xw < 3; xw++) {
+				blur_win[yw][xw] = window_buf[yw][xw].blur;
+			}
+		}
+
+		gradient_t gx = sobelXAt(blur_win, 0);
+		gradient_t gy = sobelYAt(blur_win, 0);
+		square_t xx = gx * gx;
+		square_t yy = gy * gy;
+		cross_t xy = gx * gy;
+#if TENSOR_WINDOW > 1
+		R = responseAt(sumXX.step(x, xx), sumYY.step(x, yy), sumXY.step(x, xy));
+#else
+		R = responseAt(xx, yy, xy);
+#endif
+		weightPixel cur = decideAt(R, 42, high);
+
+		for (int yw = 0; yw < 5; yw++) {
+			for (int xw = 0; xw < 4; xw++) {
+				nms_buf[yw][xw] = nms_buf[yw][xw + 1];
+			}
+		}
+		for (int i = 0; i < 4; i++)
+			nms_buf[i][4] = column.decided[i];
+		nms_buf[4][4] = cur;
+
+		column.tap[0] = column.tap[1];
+		column.tap[1] = window_buf[2][2];
+		for (int i = 0; i < 3; i++)
+			column.decided[i] = column.decided[i + 1];
+		column.decided[3] = cur;
+		line_buf[x] = column;
+
+		return suppressAt(nms_buf, 0, cur);
+	}
+};
+
+/*
+ * Moves the smoothed maximum 2^-smoothShift of the way towards max. The step
+ * is rounded to nearest with ties away from zero, so rising and falling
+ * maxima settle alike. smoothShift is clamped to 0..16.
+ */
+inline int32_t smoothMax(int32_t smoothed, int32_t max, int smoothShift) {
+	if (smoothShift < 0)
+		smoothShift = 0;
+	if (smoothShift > 16)
+		smoothShift = 16;
+	int64_t step = (int64_t) max - smoothed;
+	int64_t half = smoothShift > 0 ? (int64_t) 1 << (smoothShift - 1) : 0;
+	int64_t magnitude = ((step < 0 ? -step : step) + half) >> smoothShift;
+	return smoothed + (int32_t) (step < 0 ? -magnitude : magnitude);
+}
+
+/**
+ * Harris Corner detector for video
+ *
+ * Thresholds frame N with the maximum response of the frames before it, so
+ * decide and the suppression run in the same loop as the front end and no
+ * frame is stored. smoothShift 0 uses the maximum of the previous frame,
+ * larger values smooth it with a weight of 2^-smoothShift per frame.
+ * While state is not valid yet (first frame or with reset set) the frame is
+ * only measured and no corners are reported. Returns whether corners were
+ * searched for. With a target above 0 the threshold is the one the response
+ * histogram of the previous frame gives for target, see harrisGray.
+ */
+template<int WIDTH, int HEIGHT>
+bool harrisAdaptive(RGB_IMAGE &src, weightPixel *dst,int thresUp,thresholdState &state,int smoothShift, int rows = HEIGHT, int cols = WIDTH, int target = 0, bool reset = false){
+	static harrisFrontEnd<WIDTH> front;
+#pragma HLS DATA_PACK variable=front.line_buf
+#pragma HLS ARRAY_PARTITION variable=front.window_buf complete dim=0
+#pragma HLS ARRAY_PARTITION variable=front.nms_buf complete dim=0
+
+	responseHistogram hist;
+#pragma HLS ARRAY_PARTITION variable=hist.bin complete dim=1
+
+	hls::Scalar<3,uint8_t> pixel_value;
+	int32_t max = 0;
+	bool primed = state.valid && !reset;
+	int high = !primed ? 0x7FFFFFFF : target > 0 ? state.high : state.max - thresUp;
+
+	front.reset();
+	hist.clear();
+
+	adaptiveLoop: for (int y = 0; y < rows; y++) {
+#pragma HLS LOOP_TRIPCOUNT max=HEIGHT
+		for (int x = 0; x < cols; x++) {
+#pragma HLS LOOP_TRIPCOUNT max=WIDTH
+#pragma HLS loop_flatten off
+#pragma HLS pipeline II=1
+			src >> pixel_value;
+			int32_t R;
+			dst[x + y * cols] = front.step(x, grayPixel(pixel_value), high, R);
+			if (R > max)
+				max = R;
+			hist.add(R);
+		}
+	}
+
+	if (primed)
+		state.max = smoothMax(state.max, max, smoothShift);
+	else
+		state.max = max;
+	state.high = hist.threshold(target);
+	state.valid = true;
+	return primed;
+}
+
+/**
+ * Fused Harris Corner detector
+ *
+ * Reads every pixel once and runs gray, blur, gradient, structure tensor,
+ * response, decide and the corner suppression in one loop at II=1, with no
+ * frame buffer. A frame is thresholded with the maximum response of the
+ * frame before it, like harrisAdaptive with smoothShift 0: the first frame
+ * is only measured and gives no corners, and a frame that repeats the one
+ * before gives exactly the corners of harris().
+ */
+template<int WIDTH, int HEIGHT>
+void harrisStreaming(RGB_IMAGE &src, weightPixel *dst,int thresUp, int rows = HEIGHT, int cols = WIDTH){
+	static thresholdState state;
+	harrisAdaptive<WIDTH,HEIGHT>(src, dst, thresUp, state, 0, rows, cols);
+}
+
+/*
+ * Everything one camera leaves behind in the multi-stream pipeline between
+ * two of its rows.
+ */
+template<int WIDTH>
+struct streamContext {
+	harrisFrontEnd<WIDTH> front;
+	thresholdState state;
+	int32_t max;
+	int y;
+};
+
+/**
+ * Harris Corner detector for several cameras in one pipeline
+ *
+ * Reads rowCount rows of cols pixels from src. Every row belongs to the
+ * camera in TID of its beats, masked to STREAMS - 1 so that a stray TID can
+ * never index past the cameras. The rows of the cameras may interleave in
+ * any order and a start of frame in user restarts that camera. Each camera
+ * keeps its own line buffers, thresUp[id] and running maximum and is
+ * thresholded like harrisAdaptive, so its output matches harrisAdaptive on
+ * that camera alone. Output pixels carry the camera id.
+ */
+template<int WIDTH, int HEIGHT, int STREAMS>
+void harrisMultiStream(AXI_TAGGED_STREAM &src, taggedPixel *dst, int *thresUp, int smoothShift, int rowCount, int rows = HEIGHT, int cols = WIDTH){
+	static_assert(STREAMS > 0 && (STREAMS & (STREAMS - 1)) == 0, "STREAMS must be a power of two");
+	static streamContext<WIDTH> context[STREAMS];
+
+	ap_axiu<32,1,8,1> beat;
+	hls::Scalar<3,uint8_t> pixel_value;
+
+	rowLoop: for (int r = 0; r < rowCount; r++) {
+#pragma HLS LOOP_TRIPCOUNT max=HEIGHT*STREAMS
+		src >> beat;
+		int id = beat.id & (STREAMS - 1);
+		streamContext<WIDTH> &ctx = context[id];
+		if (beat.user) {
+			ctx.front.reset();
+			ctx.max = 0;
+			ctx.y = 0;
+		}
+		int high = ctx.state.valid ? ctx.state.max - thresUp[id] : 0x7FFFFFFF;
+		int32_t max = ctx.max;
+
+		columnLoop: for (int x = 0; x < cols; x++) {
+#pragma HLS LOOP_TRIPCOUNT max=WIDTH
+#pragma HLS pipeline II=1
+			if (x != 0)
+				src >> beat;
+			for (int c = 0; c < 3; c++)
+				pixel_value.val[c] = beat.data.range(8 * c + 7, 8 * c);
+			int32_t R;
+			taggedPixel out;
+			out.pixel = ctx.front.step(x, grayPixel(pixel_value), high, R);
+			out.id = id;
+			if (R > max)
+				max = R;
+			dst[x + r * cols] = out;
+		}
+
+		ctx.max = max;
+		if (++ctx.y == rows) {
+			if (ctx.state.valid)
+				ctx.state.max = smoothMax(ctx.state.max, max, smoothShift);
+			else
+				ctx.state.max = max;
+			ctx.state.valid = true;
+			ctx.y = 0;
+		}
+	}
+}
+
+/*
+ * Gauss5 in front of the decimation of a pyramid level. step returns the
+ * blurred pixel whose window ends at column x of the current row.
+ */
+template<int WIDTH>
+struct pyramidDown {
+	uint8_t line_buf[5][WIDTH];
+	uint8_t window_buf[5][5];
+
+	void reset() {
+		for (int i = 0; i < 5; i++) {
+			for (int j = 0; j < 5; j++)
+				window_buf[i][j] = 0;
+			for (int x = 0; x < WIDTH; x++)
+				line_buf[i][x] = 0;
+		}
+	}
+
+	uint8_t step(int x, uint8_t pix) {
+		for (int i = 0; i < 4; i++)
+			line_buf[i][x] = line_buf[i + 1][x];
+		line_buf[4][x] = pix;
+
+		for (int yw = 0; yw < 5; yw++) {
+			for (int xw = 0; xw < 4; xw++) {
+				window_buf[yw][xw] = window_buf[yw][xw + 1];
+			}
+		}
+		for (int yw = 0; yw < 5; yw++)
+			window_buf[yw][4] = line_buf[yw][x];
+
+		return gauss5At(window_buf, 0);
+	}
+};
+
+/*
+ * One octave of the pyramid and, through next, all smaller ones. Pixel
+ * (u, v) of the next level is the blurred pixel of this level whose window
+ * ends at (2u + 1, 2v + 1), so every level sees a quarter of the pixels of
+ * the one above and keeps line buffers of half the width. Every level is
+ * thresholded with its own maximum of the frame before, as in
+ * harrisAdaptive, so decide and the suppression run while the frame
+ * streams in.
+ */
+template<int WIDTH, int HEIGHT, int LEVELS>
+struct pyramidLevel {
+	harrisFrontEnd<WIDTH> front;
+	pyramidDown<WIDTH> down;
+	pyramidLevel<WIDTH / 2, HEIGHT / 2, LEVELS - 1> next;
+	thresholdState state;
+	int32_t high;
+	int32_t max;
+
+	void reset(int thresUp) {
+		front.reset();
+		down.reset();
+		next.reset(thresUp);
+		high = state.valid ? state.max - thresUp : 0x7FFFFFFF;
+		max = 0;
+	}
+
+	void endFrame() {
+		state.max = max;
+		state.valid = true;
+		next.endFrame();
+	}
+
+	/* candidates holds one stream for this level followed by the smaller ones */
+	void step(hls::stream<cornerCandidate> *candidates, int x, int y, int level, uint8_t gray) {
+		int32_t R;
+		weightPixel px = front.step(x, gray, high, R);
+		if (R > max)
+			max = R;
+		if (px.t() == corner) {
+			cornerRecord c;
+			c.x = x << level;
+			c.y = y << level;
+			c.score = px.value();
+			c.level = level;
+			c.last = false;
+			candidates[0].write(candidateOf(c, 0));
+		}
+
+		uint8_t blur = down.step(x, gray);
+		if ((x & 1) && (y & 1))
+			next.step(candidates + 1, x >> 1, y >> 1, level + 1, blur);
+	}
+};
+
+template<int WIDTH, int HEIGHT>
+struct pyramidLevel<WIDTH, HEIGHT, 0> {
+	void reset(int) {
+	}
+
+	void endFrame() {
+	}
+
+	void step(hls::stream<cornerCandidate> *, int, int, int, uint8_t) {
+	}
+};
+
+/*
+ * Pixel loop of harrisPyramid, every level writes its corners as candidates
+ * to its own stream followed by end
+ */
+template<int WIDTH, int HEIGHT, int LEVELS>
+void PyramidCandidates(RGB_IMAGE &src, hls::stream<cornerCandidate> *candidates, int thresUp, int rows, int cols){
+	static pyramidLevel<WIDTH, HEIGHT, LEVELS> pyramid;
+#pragma HLS DATA_PACK variable=pyramid.front.line_buf
+#pragma HLS ARRAY_PARTITION variable=pyramid.front.window_buf complete dim=0
+#pragma HLS ARRAY_PARTITION variable=pyramid.front.nms_buf complete dim=0
+#pragma HLS ARRAY_RESHAPE variable=pyramid.down.line_buf complete dim=1
+#pragma HLS ARRAY_PARTITION variable=pyramid.down.window_buf complete dim=0
+
+	hls::Scalar<3,uint8_t> pixel_value;
+
+	pyramid.reset(thresUp);
 
+	pyramidLoop: for (int y = 0; y < rows; y++) {
+#pragma HLS LOOP_TRIPCOUNT max=HEIGHT
+		for (int x = 0; x < cols; x++) {
+#pragma HLS LOOP_TRIPCOUNT max=WIDTH
+#pragma HLS loop_flatten off
+#pragma HLS pipeline II=1
+			src >> pixel_value;
+			pyramid.step(candidates, x, y, 0, grayPixel(pixel_value));
+		}
+	}
+
+	pyramid.endFrame();
+	for (int l = 0; l < LEVELS; l++)
+		candidates[l].write(candidateMark(true));
 }
 
+/*
+ * Merges the candidate streams of the levels into one, the lowest level
+ * with a candidate waiting goes first. Ends once every level has ended.
+ */
+template<int LEVELS>
+void MergeCandidates(hls::stream<cornerCandidate> *levels, hls::stream<cornerCandidate> &candidates){
+	int open = LEVELS;
+
+	mergeLoop: while (open != 0) {
+#pragma HLS LOOP_TRIPCOUNT max=MAX_WIDTH*MAX_HEIGHT/9
+#pragma HLS PIPELINE II=1
+		bool taken = false;
+		for (int l = 0; l < LEVELS; l++) {
+			if (!taken && !levels[l].empty()) {
+				cornerCandidate k = levels[l].read();
+				taken = true;
+				if (k.end)
+					open--;
+				else
+					candidates.write(k);
+			}
+		}
+	}
+	candidates.write(candidateMark(true));
+}
+
+/**
+ * Multi-scale Harris Corner detector
+ *
+ * Builds LEVELS octaves with Gauss5 and 2x decimation while the frame
+ * streams in and runs the Harris response, decide and suppression of every
+ * level in the same II=1 pixel loop, with no frame buffer. Each level is
+ * thresholded with its own maximum of the frame before, so the first frame
+ * gives no corners and on a frame that repeats the one before level 0 gives
+ * exactly the corners of harris(). The N strongest corners of all levels
+ * are merged into one list tagged with their level, x and y are in input
+ * pixels.
+ */
+template<int WIDTH, int HEIGHT, int LEVELS, int N>
+void harrisPyramid(RGB_IMAGE &src, cornerRecord *listOut, uint16_t &count, int thresUp, int rows = HEIGHT, int cols = WIDTH){
+#pragma HLS DATAFLOW
+	static hls::stream<cornerCandidate> levels[LEVELS];
+	static hls::stream<cornerCandidate> candidates;
+#pragma HLS STREAM variable=levels depth=CANDIDATE_DEPTH
+#pragma HLS STREAM variable=candidates depth=CANDIDATE_DEPTH
+
+	PyramidCandidates<WIDTH,HEIGHT,LEVELS>(src, levels, thresUp, rows, cols);
+	MergeCandidates<LEVELS>(levels, candidates);
+	TopCorners<N,1>(candidates, listOut, count);
+}
 
 template<int WIDTH, int HEIGHT>
-void canny(RGB_IMAGE &src, RGB_IMAGE &dst,int hyst_thres){
+void canny(RGB_IMAGE &src, RGB_IMAGE &dst,int low,int high, int rows = HEIGHT, int cols = WIDTH){
 
 #pragma HLS DATAFLOW
-	static uint8_t 		fifo1[WIDTH*HEIGHT*3];
+	static uint8_t 		fifo1[WIDTH*HEIGHT];
 	static uint8_t 		fifo2[WIDTH*HEIGHT];
 	static directedPixel 	fifo3[WIDTH*HEIGHT];
 	static uint8_t 		fifo4[WIDTH*HEIGHT];
@@ -798,13 +2647,125 @@ void canny(RGB_IMAGE &src, RGB_IMAGE &dst,int hyst_thres){
 #pragma HLS STREAM variable=fifo6 depth=1 dim=1
 
 
-	MatToGrayArray<WIDTH,HEIGHT>(src,fifo1);
-	Gauss3<WIDTH,HEIGHT>(fifo1,fifo2);
-	Sobel<WIDTH,HEIGHT>(fifo2,fifo3);
-	NonMaxSuppression<WIDTH,HEIGHT>(fifo3,fifo4);
-	Hysteresis<WIDTH,HEIGHT>(fifo4,fifo5,hyst_thres);
-	ZeroBorder<WIDTH,HEIGHT>(fifo4,fifo6,5);
-	ArrayToMat<WIDTH,HEIGHT>(fifo6, dst);
+	const int n = rows * cols;
+	(void) n;
+
+	HARRIS_STAGE(stageGray, n, n, MatToGrayArray<WIDTH,HEIGHT>(src,fifo1,rows,cols));
+	HARRIS_STAGE(stageGauss, n, n, Gauss3<WIDTH,HEIGHT>(fifo1,fifo2,rows,cols));
+	HARRIS_STAGE(stageEdgeGradient, n, n, Sobel<WIDTH,HEIGHT>(fifo2,fifo3,rows,cols));
+	HARRIS_STAGE(stageEdgeSuppress, n, n, NonMaxSuppression<WIDTH,HEIGHT>(fifo3,fifo4,rows,cols));
+	HARRIS_STAGE(stageHysteresis, n, n, Hysteresis<WIDTH,HEIGHT>(fifo4,fifo5,low,high,rows,cols));
+	HARRIS_STAGE(stageBorder, n, n, ZeroBorder<WIDTH,HEIGHT>(fifo5,fifo6,5,rows,cols));
+	ArrayToMat<WIDTH,HEIGHT>(fifo6, dst,rows,cols);
 
 }
+
+/**
+ * Harris corners and Canny edges of one frame
+ *
+ * The frame is read, converted and blurred once, and SobelX/SobelY feed both
+ * the structure tensor branch of harris() and the magnitude, direction and
+ * edge suppression branch of canny(). corners is what harris() gives, edges
+ * is the single channel of what canny() gives.
+ */
+template<int WIDTH, int HEIGHT>
+void harrisCanny(RGB_IMAGE &src, weightPixel *corners, uint8_t *edges, int thresUp, int low, int high, int rows = HEIGHT, int cols = WIDTH){
+
+#pragma HLS DATAFLOW
+	static uint8_t 		fifo1[WIDTH*HEIGHT];
+	static uint8_t 		fifo2[WIDTH*HEIGHT];
+	static uint8_t 		fifo3[WIDTH*HEIGHT];
+	static uint8_t 		fifo4[WIDTH*HEIGHT];
+	static gradient_t 	SobelXFIFO[WIDTH*HEIGHT];
+	static gradient_t 	SobelYFIFO[WIDTH*HEIGHT];
+	static gradient_t 	harrisX[WIDTH*HEIGHT];
+	static gradient_t 	harrisY[WIDTH*HEIGHT];
+	static gradient_t 	edgeX[WIDTH*HEIGHT];
+	static gradient_t 	edgeY[WIDTH*HEIGHT];
+	static gradient_t 	fifo5[WIDTH*HEIGHT];
+	static gradient_t 	fifo6[WIDTH*HEIGHT];
+	static gradient_t 	fifo7[WIDTH*HEIGHT];
+	static gradient_t 	fifo8[WIDTH*HEIGHT];
+	static gradient_t 	fifo9[WIDTH*HEIGHT];
+	static gradient_t 	fifoA[WIDTH*HEIGHT];
+	static square_t 	SobelXX[WIDTH*HEIGHT];
+	static square_t 	SobelYY[WIDTH*HEIGHT];
+	static cross_t 		SobelXY[WIDTH*HEIGHT];
+	static response_t 	Response[WIDTH*HEIGHT];
+	static weightPixel  harris[WIDTH*HEIGHT];
+	static response_t  	min_max[WIDTH*HEIGHT];
+	static directedPixel gradient[WIDTH*HEIGHT];
+	static uint8_t 		suppressed[WIDTH*HEIGHT];
+	static uint8_t 		hysteresis[WIDTH*HEIGHT];
+
+	int32_t max=0;
+
+#pragma HLS STREAM variable=fifo1 depth=1 dim=1
+#pragma HLS STREAM variable=fifo2 depth=1 dim=1
+#pragma HLS STREAM variable=fifo3 depth=1 dim=1
+#pragma HLS STREAM variable=fifo4 depth=1 dim=1
+#pragma HLS STREAM variable=SobelXFIFO depth=1 dim=1
+#pragma HLS STREAM variable=SobelYFIFO depth=1 dim=1
+#pragma HLS STREAM variable=harrisX depth=1 dim=1
+#pragma HLS STREAM variable=harrisY depth=1 dim=1
+#pragma HLS STREAM variable=edgeX depth=1 dim=1
+#pragma HLS STREAM variable=edgeY depth=1 dim=1
+#pragma HLS STREAM variable=fifo5 depth=1 dim=1
+#pragma HLS STREAM variable=fifo6 depth=1 dim=1
+#pragma HLS STREAM variable=fifo7 depth=1 dim=1
+#pragma HLS STREAM variable=fifo8 depth=1 dim=1
+#pragma HLS STREAM variable=fifo9 depth=1 dim=1
+#pragma HLS STREAM variable=fifoA depth=1 dim=1
+#pragma HLS STREAM variable=SobelXX depth=1 dim=1
+#pragma HLS STREAM variable=SobelYY depth=1 dim=1
+#pragma HLS STREAM variable=SobelXY depth=1 dim=1
+#pragma HLS STREAM variable=Response depth=1 dim=1
+#pragma HLS STREAM variable=min_max depth=1 dim=1
+#pragma HLS STREAM variable=harris depth=1 dim=1
+#pragma HLS STREAM variable=gradient depth=1 dim=1
+#pragma HLS STREAM variable=suppressed depth=1 dim=1
+#pragma HLS STREAM variable=hysteresis depth=1 dim=1
+
+	const int n = rows * cols;
+	(void) n;
+
+	HARRIS_STAGE(stageGray, n, n, MatToGrayArray<WIDTH,HEIGHT>(src,fifo1,rows,cols));
+	HARRIS_STAGE(stageGauss, n, n, Gauss3<WIDTH,HEIGHT>(fifo1,fifo2,rows,cols));
+	HARRIS_STAGE(stageGauss, n, 2*n, Dublicate<WIDTH,HEIGHT>(fifo2,fifo3,fifo4,rows,cols));
+	HARRIS_STAGE(stageSobel, n, n, SobelY<WIDTH,HEIGHT>(fifo3,SobelYFIFO,rows,cols));
+	HARRIS_STAGE(stageSobel, n, n, SobelX<WIDTH,HEIGHT>(fifo4,SobelXFIFO,rows,cols));
+	HARRIS_STAGE(stageSobel, n, 2*n, Dublicate<WIDTH,HEIGHT>(SobelXFIFO,harrisX,edgeX,rows,cols));
+	HARRIS_STAGE(stageSobel, n, 2*n, Dublicate<WIDTH,HEIGHT>(SobelYFIFO,harrisY,edgeY,rows,cols));
+
+	/* corner branch */
+	HARRIS_STAGE(stageSobel, n, 3*n, tripleSignal<WIDTH,HEIGHT>(harrisX,fifo5,fifo6,fifo7,rows,cols));
+	HARRIS_STAGE(stageSobel, n, 3*n, tripleSignal<WIDTH,HEIGHT>(harrisY,fifo8,fifo9,fifoA,rows,cols));
+	HARRIS_STAGE(stageMul, 2*n, n, Mul<WIDTH,HEIGHT>(fifo5,fifo6,SobelXX,rows,cols));
+	HARRIS_STAGE(stageMul, 2*n, n, Mul<WIDTH,HEIGHT>(fifo8,fifo9,SobelYY,rows,cols));
+	HARRIS_STAGE(stageMul, 2*n, n, Mul<WIDTH,HEIGHT>(fifo7,fifoA,SobelXY,rows,cols));
+#if TENSOR_WINDOW > 1
+	static square_t 	SumXX[WIDTH*HEIGHT];
+	static square_t 	SumYY[WIDTH*HEIGHT];
+	static cross_t 		SumXY[WIDTH*HEIGHT];
+#pragma HLS STREAM variable=SumXX depth=1 dim=1
+#pragma HLS STREAM variable=SumYY depth=1 dim=1
+#pragma HLS STREAM variable=SumXY depth=1 dim=1
+	HARRIS_STAGE(stageTensor, 3*n, 3*n, TensorWindow<WIDTH,HEIGHT,TENSOR_WINDOW,TENSOR_GAUSSIAN>(SobelXX,SobelYY,SobelXY,SumXX,SumYY,SumXY,rows,cols));
+	HARRIS_STAGE(stageResponse, 3*n, n, ResponseCalc<WIDTH,HEIGHT>(SumXX,SumYY,SumXY,Response,rows,cols));
+#else
+	HARRIS_STAGE(stageResponse, 3*n, n, ResponseCalc<WIDTH,HEIGHT>(SobelXX,SobelYY,SobelXY,Response,rows,cols));
+#endif
+	HARRIS_STAGE(stageMinMax, n, n, MinMax<WIDTH,HEIGHT>(Response,min_max,max,rows,cols));
+	HARRIS_STAGE(stageDecide, n, n, decide<WIDTH,HEIGHT>(min_max,harris,42,max-thresUp,rows,cols));
+	HARRIS_STAGE(stageSuppress, n, n, NonMaxSurpression<WIDTH,HEIGHT>(harris,corners,rows,cols));
+
+	/* edge branch */
+	HARRIS_STAGE(stageEdgeGradient, 2*n, n, EdgeGradient<WIDTH,HEIGHT>(edgeX,edgeY,gradient,rows,cols));
+	HARRIS_STAGE(stageEdgeSuppress, n, n, NonMaxSuppression<WIDTH,HEIGHT>(gradient,suppressed,rows,cols));
+	HARRIS_STAGE(stageHysteresis, n, n, Hysteresis<WIDTH,HEIGHT>(suppressed,hysteresis,low,high,rows,cols));
+	HARRIS_STAGE(stageBorder, n, n, ZeroBorder<WIDTH,HEIGHT>(hysteresis,edges,5,rows,cols));
+	HARRIS_FRAME(corners, n);
+}
 }
+
+#endif
@@ -0,0 +1,209 @@
+#ifndef HARRIS_CONTEXT_HPP
+#define HARRIS_CONTEXT_HPP
+
+#include "harris.hpp"
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+/*
+ * Reentrant software detectors.
+ *
+ * harris() and canny() keep their frames in function local static arrays
+ * because synthesis maps them onto the FIFOs of the DATAFLOW region. In a
+ * software build that is tens of megabytes of BSS shared by every caller.
+ * A context owns the same buffers instead, sized for the frame it runs and
+ * carved from an arena it keeps across frames, together with the line
+ * buffers of the stages that hold state. Contexts share nothing but the
+ * HARRIS_STATS totals, which are locked, so several of them can run side
+ * by side on different threads. The stages are the
+ * ones of harris.hpp, without the copies that only fan data out in hardware.
+ */
+
+namespace imgProc {
+
+/*
+ * Bump allocator for the frame buffers of a context. reset() hands out the
+ * same memory again, so once the largest frame has been seen a frame costs
+ * neither allocations nor page faults.
+ */
+class frameArena {
+public:
+	frameArena() : chunk(0), used(0) {
+	}
+
+	void reset() {
+		chunk = 0;
+		used = 0;
+	}
+
+	template<typename T>
+	T *take(size_t n) {
+		size_t bytes = (n * sizeof(T) + ALIGN - 1) & ~(size_t) (ALIGN - 1);
+		while (chunk < blocks.size() && used + bytes > blocks[chunk].size) {
+			chunk++;
+			used = 0;
+		}
+		if (chunk == blocks.size())
+			blocks.push_back(block(bytes > CHUNK ? bytes : (size_t) CHUNK));
+		T *p = reinterpret_cast<T *>(blocks[chunk].data() + used);
+		used += bytes;
+		if (!std::is_pod<T>::value)
+			for (size_t i = 0; i < n; i++)
+				new (p + i) T();
+		return p;
+	}
+
+	/* Bytes held over all frames so far */
+	size_t capacity() const {
+		size_t total = 0;
+		for (size_t i = 0; i < blocks.size(); i++)
+			total += blocks[i].size;
+		return total;
+	}
+
+private:
+	enum { ALIGN = 64, CHUNK = 1 << 20 };
+
+	struct block {
+		std::shared_ptr<unsigned char> memory;
+		size_t size;
+
+		explicit block(size_t size) : memory(new unsigned char[size + ALIGN],
+				std::default_delete<unsigned char[]>()), size(size) {
+		}
+
+		unsigned char *data() const {
+			size_t address = reinterpret_cast<size_t>(memory.get());
+			return memory.get() + ((ALIGN - address % ALIGN) % ALIGN);
+		}
+	};
+
+	std::vector<block> blocks;
+	size_t chunk;
+	size_t used;
+};
+
+/**
+ * Harris Corner detector with its own buffers
+ *
+ * run() gives the same frame as harris() with the same arguments, runGray()
+ * the same as harrisGray(). Create it once and reuse it for every frame.
+ */
+template<int WIDTH, int HEIGHT>
+class HarrisContext {
+public:
+	HarrisContext()
+#if TENSOR_WINDOW > 1
+		: sumXX(new tensorSquare), sumYY(new tensorSquare), sumXY(new tensorCross)
+#endif
+	{
+	}
+
+	void run(RGB_IMAGE &src, weightPixel *dst, int thresUp, int rows = HEIGHT,
+			int cols = WIDTH, int target = 0) {
+		const int n = rows * cols;
+		arena.reset();
+		uint8_t *gray = arena.take<uint8_t>(n);
+		HARRIS_STAGE(stageGray, n, n, MatToGrayArray<WIDTH,HEIGHT>(src, gray, rows, cols));
+		stages(gray, dst, thresUp, rows, cols, target);
+	}
+
+	void runGray(uint8_t *gray, weightPixel *dst, int thresUp, int rows = HEIGHT,
+			int cols = WIDTH, int target = 0) {
+		arena.reset();
+		stages(gray, dst, thresUp, rows, cols, target);
+	}
+
+	const frameArena &memory() const {
+		return arena;
+	}
+
+private:
+	typedef tensorSum<WIDTH, TENSOR_WINDOW, TENSOR_GAUSSIAN, square_t> tensorSquare;
+	typedef tensorSum<WIDTH, TENSOR_WINDOW, TENSOR_GAUSSIAN, cross_t> tensorCross;
+
+	void stages(uint8_t *gray, weightPixel *dst, int thresUp, int rows, int cols, int target) {
+		const int n = rows * cols;
+		uint8_t *blur = arena.take<uint8_t>(n);
+		gradient_t *gradX = arena.take<gradient_t>(n);
+		gradient_t *gradY = arena.take<gradient_t>(n);
+		square_t *xx = arena.take<square_t>(n);
+		square_t *yy = arena.take<square_t>(n);
+		cross_t *xy = arena.take<cross_t>(n);
+		response_t *response = arena.take<response_t>(n);
+		weightPixel *decided = arena.take<weightPixel>(n);
+		int32_t max = 0;
+
+		HARRIS_STAGE(stageGauss, n, n, Gauss3<WIDTH,HEIGHT>(gray, blur, rows, cols));
+		HARRIS_STAGE(stageSobel, n, n, SobelY<WIDTH,HEIGHT>(blur, gradY, rows, cols));
+		HARRIS_STAGE(stageSobel, n, n, SobelX<WIDTH,HEIGHT>(blur, gradX, rows, cols));
+		HARRIS_STAGE(stageMul, 2*n, n, Mul<WIDTH,HEIGHT>(gradX, gradX, xx, rows, cols));
+		HARRIS_STAGE(stageMul, 2*n, n, Mul<WIDTH,HEIGHT>(gradY, gradY, yy, rows, cols));
+		HARRIS_STAGE(stageMul, 2*n, n, Mul<WIDTH,HEIGHT>(gradX, gradY, xy, rows, cols));
+#if TENSOR_WINDOW > 1
+		square_t *sumXXFrame = arena.take<square_t>(n);
+		square_t *sumYYFrame = arena.take<square_t>(n);
+		cross_t *sumXYFrame = arena.take<cross_t>(n);
+		HARRIS_STAGE(stageTensor, 3*n, 3*n, TensorWindow<WIDTH,HEIGHT,TENSOR_WINDOW,TENSOR_GAUSSIAN>(
+				*sumXX, *sumYY, *sumXY, xx, yy, xy, sumXXFrame, sumYYFrame, sumXYFrame, rows, cols));
+		HARRIS_STAGE(stageResponse, 3*n, n, ResponseCalc<WIDTH,HEIGHT>(sumXXFrame, sumYYFrame, sumXYFrame, response, rows, cols));
+#else
+		HARRIS_STAGE(stageResponse, 3*n, n, ResponseCalc<WIDTH,HEIGHT>(xx, yy, xy, response, rows, cols));
+#endif
+		HARRIS_STAGE(stageMinMax, n, n, MinMaxHistogram<WIDTH,HEIGHT>(response, response, max, hist, rows, cols));
+		HARRIS_STAGE(stageDecide, n, n, decide<WIDTH,HEIGHT>(response, decided, 42,
+				target > 0 ? hist.threshold(target) : max - thresUp, rows, cols));
+		HARRIS_STAGE(stageSuppress, n, n, NonMaxSurpression<WIDTH,HEIGHT>(decided, dst, rows, cols));
+		HARRIS_FRAME(dst, n);
+	}
+
+	frameArena arena;
+	responseHistogram hist;
+#if TENSOR_WINDOW > 1
+	std::unique_ptr<tensorSquare> sumXX, sumYY;
+	std::unique_ptr<tensorCross> sumXY;
+#endif
+};
+
+/**
+ * Canny edge detector with its own buffers, gives the same frame as canny()
+ */
+template<int WIDTH, int HEIGHT>
+class CannyContext {
+public:
+	CannyContext() : labels(new hysteresisLabels<WIDTH, HYSTERESIS_ROWS>) {
+	}
+
+	void run(RGB_IMAGE &src, RGB_IMAGE &dst, int low, int high, int rows = HEIGHT, int cols = WIDTH) {
+		const int n = rows * cols;
+		arena.reset();
+		uint8_t *gray = arena.take<uint8_t>(n);
+		uint8_t *blur = arena.take<uint8_t>(n);
+		directedPixel *gradient = arena.take<directedPixel>(n);
+		uint8_t *thin = arena.take<uint8_t>(n);
+		uint8_t *edges = arena.take<uint8_t>(n);
+		uint8_t *border = arena.take<uint8_t>(n);
+
+		MatToGrayArray<WIDTH,HEIGHT>(src, gray, rows, cols);
+		Gauss3<WIDTH,HEIGHT>(gray, blur, rows, cols);
+		Sobel<WIDTH,HEIGHT>(blur, gradient, rows, cols);
+		NonMaxSuppression<WIDTH,HEIGHT>(gradient, thin, rows, cols);
+		Hysteresis<WIDTH,HEIGHT>(*labels, thin, edges, low, high, rows, cols);
+		ZeroBorder<WIDTH,HEIGHT>(edges, border, 5, rows, cols);
+		ArrayToMat<WIDTH,HEIGHT>(border, dst, rows, cols);
+	}
+
+	const frameArena &memory() const {
+		return arena;
+	}
+
+private:
+	frameArena arena;
+	std::unique_ptr<hysteresisLabels<WIDTH, HYSTERESIS_ROWS> > labels;
+};
+
+}
+
+#endif
@@ -0,0 +1,466 @@
+#ifndef HARRIS_DATAFLOW_HPP
+#define HARRIS_DATAFLOW_HPP
+
+#include "harris_simd.hpp"
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+/*
+ * Software dataflow runtime of the Harris and Canny stage chains.
+ *
+ * A C simulation build runs the stages of a DATAFLOW region one after the
+ * other over whole frames. Here every stage runs on its own thread and hands
+ * rows to the next one over a bounded single producer, single consumer ring,
+ * the way the STREAM FIFOs connect the stages in hardware. A window stage
+ * keeps only the rows its window reaches back, so the working set is a few
+ * rows per stage, apart from the frame that decide has to wait for (see
+ * harris below) and the rows Hysteresis holds back (see canny). A ring that is too shallow stalls its producer just like a
+ * full FIFO does, and every ring reports the highest fill it has seen.
+ */
+
+/*
+ * Rows every ring between two stages holds.
+ */
+#ifndef DATAFLOW_DEPTH
+#define DATAFLOW_DEPTH 2
+#endif
+
+namespace imgProc {
+namespace dataflow {
+
+/*
+ * Lock-free ring of depth rows of cols pixels between one producer and one
+ * consumer. The producer fills claim() and publishes it with push(), the
+ * consumer reads front() and hands the slot back with pop().
+ */
+template<typename T>
+class rowChannel {
+public:
+	rowChannel(int depth, int cols) : slot(depth * cols), depth(depth),
+			cols(cols), head(0), tail(0), peak(0) {
+	}
+
+	/* Slot of the next row, waits while the ring is full */
+	T *claim() {
+		int h = head.load(std::memory_order_relaxed);
+		while (h - tail.load(std::memory_order_acquire) == depth)
+			std::this_thread::yield();
+		return &slot[(h % depth) * cols];
+	}
+
+	void push() {
+		int h = head.load(std::memory_order_relaxed) + 1;
+		head.store(h, std::memory_order_release);
+		int fill = h - tail.load(std::memory_order_acquire);
+		if (fill > peak)
+			peak = fill;
+	}
+
+	/* Oldest row, waits while the ring is empty */
+	const T *front() {
+		int t = tail.load(std::memory_order_relaxed);
+		while (head.load(std::memory_order_acquire) == t)
+			std::this_thread::yield();
+		return &slot[(t % depth) * cols];
+	}
+
+	void pop() {
+		tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	int size() const {
+		return depth;
+	}
+
+	/* Highest fill in rows, valid once the producer has finished */
+	int highWater() const {
+		return peak;
+	}
+
+private:
+	std::vector<T> slot;
+	int depth;
+	int cols;
+	std::atomic<int> head;
+	std::atomic<int> tail;
+	int peak;
+};
+
+/*
+ * The back rows a window stage reaches into, current row last. The rows
+ * before the frame are zero, so the spans find the same zeros there as at
+ * the start of a whole frame.
+ */
+template<typename T>
+struct rowHistory {
+	std::vector<T> row;
+	int back;
+	int cols;
+
+	rowHistory(int back, int cols) : row((back + 1) * cols, T()), back(back), cols(cols) {
+	}
+
+	void push(const T *in) {
+		memmove(&row[0], &row[cols], back * cols * sizeof(T));
+		memcpy(&row[back * cols], in, cols * sizeof(T));
+	}
+
+	const T *data() const {
+		return &row[0];
+	}
+
+	int begin() const {
+		return back * cols;
+	}
+
+	int end() const {
+		return (back + 1) * cols;
+	}
+};
+
+/* Ring fill of one edge of the graph */
+struct channelReport {
+	const char *name;
+	int depth;
+	int peak;
+};
+
+template<typename T>
+inline void reportChannel(std::vector<channelReport> *report, const char *name, rowChannel<T> &c) {
+	if (!report)
+		return;
+	channelReport r;
+	r.name = name;
+	r.depth = c.size();
+	r.peak = c.highWater();
+	report->push_back(r);
+}
+
+template<int WIDTH, int HEIGHT>
+void grayStage(RGB_IMAGE &src, rowChannel<uint8_t> &out, int rows, int cols) {
+	std::vector<uint8_t> plane[3];
+	for (int c = 0; c < 3; c++)
+		plane[c].resize(cols);
+	hls::Scalar<3,uint8_t> pixel_value;
+	for (int y = 0; y < rows; y++) {
+		for (int x = 0; x < cols; x++) {
+			src >> pixel_value;
+			for (int c = 0; c < 3; c++)
+				plane[c][x] = pixel_value.val[c];
+		}
+		simd::graySpan(&plane[0][0], &plane[1][0], &plane[2][0], out.claim(), 0, cols);
+		out.push();
+	}
+}
+
+/* A window of KERNEL::SIZE reaches KERNEL::SIZE - 1 rows and pixels back */
+template<typename KERNEL, typename T>
+void convStage(rowChannel<uint8_t> &in, rowChannel<T> &out, int rows, int cols) {
+	rowHistory<uint8_t> history(KERNEL::SIZE, cols);
+	std::vector<T> line(history.end());
+	for (int y = 0; y < rows; y++) {
+		history.push(in.front());
+		in.pop();
+		simd::convSpan<KERNEL>(history.data(), &line[0], history.begin(), history.end(), cols);
+		memcpy(out.claim(), &line[history.begin()], cols * sizeof(T));
+		out.push();
+	}
+}
+
+/* The Dublicate and tripleSignal copies, one ring per consumer */
+template<typename T>
+void forkStage(rowChannel<T> &in, rowChannel<T> &out1, rowChannel<T> &out2, int rows, int cols) {
+	for (int y = 0; y < rows; y++) {
+		const T *row = in.front();
+		memcpy(out1.claim(), row, cols * sizeof(T));
+		memcpy(out2.claim(), row, cols * sizeof(T));
+		in.pop();
+		out1.push();
+		out2.push();
+	}
+}
+
+/* Products of two gradient rings, or the square of one if both are the same */
+template<typename P>
+void mulStage(rowChannel<int16_t> &in1, rowChannel<int16_t> &in2, rowChannel<P> &out, int rows, int cols) {
+	for (int y = 0; y < rows; y++) {
+		const int16_t *row1 = in1.front();
+		const int16_t *row2 = &in1 == &in2 ? row1 : in2.front();
+		simd::mulSpan(row1, row2, out.claim(), 0, cols);
+		in1.pop();
+		if (&in1 != &in2)
+			in2.pop();
+		out.push();
+	}
+}
+
+template<typename T>
+void tensorStage(rowChannel<T> &in, rowChannel<T> &out, int rows, int cols) {
+	rowHistory<T> history(TENSOR_WINDOW, cols);
+	std::vector<T> line(history.end());
+	for (int y = 0; y < rows; y++) {
+		history.push(in.front());
+		in.pop();
+		simd::tensorSpan<TENSOR_WINDOW, TENSOR_GAUSSIAN>(history.data(), &line[0],
+				history.begin(), history.end(), cols);
+		memcpy(out.claim(), &line[history.begin()], cols * sizeof(T));
+		out.push();
+	}
+}
+
+inline void responseStage(rowChannel<uint32_t> &xx, rowChannel<uint32_t> &yy,
+		rowChannel<int32_t> &xy, rowChannel<int32_t> &out, int rows, int cols) {
+	for (int y = 0; y < rows; y++) {
+		simd::responseSpan(xx.front(), yy.front(), xy.front(), out.claim(), 0, cols);
+		xx.pop();
+		yy.pop();
+		xy.pop();
+		out.push();
+	}
+}
+
+/* MinMax, the maximum is only known once the last row has passed */
+inline void maxStage(rowChannel<int32_t> &in, rowChannel<int32_t> &out,
+		std::promise<int32_t> &max, int rows, int cols) {
+	int32_t m = 0;
+	for (int y = 0; y < rows; y++) {
+		const int32_t *row = in.front();
+		m = simd::maxSpan(row, 0, cols, m);
+		memcpy(out.claim(), row, cols * sizeof(int32_t));
+		in.pop();
+		out.push();
+	}
+	max.set_value(m);
+}
+
+inline void decideStage(rowChannel<int32_t> &in, rowChannel<weightPixel> &out,
+		std::shared_future<int32_t> max, int thresUp, int rows, int cols) {
+	int high = max.get() - thresUp;
+	for (int y = 0; y < rows; y++) {
+		simd::decideSpan(in.front(), out.claim(), 0, cols, 42, high);
+		in.pop();
+		out.push();
+	}
+}
+
+/* NonMaxSurpression reaches 4 rows and 4 pixels back */
+inline void suppressStage(rowChannel<weightPixel> &in, weightPixel *dst, int rows, int cols) {
+	rowHistory<weightPixel> history(5, cols);
+	std::vector<weightPixel> line(history.end());
+	for (int y = 0; y < rows; y++) {
+		history.push(in.front());
+		in.pop();
+		simd::suppressSpan(history.data(), &line[0], history.begin(), history.end(), cols);
+		memcpy(dst + y * cols, &line[history.begin()], cols * sizeof(weightPixel));
+	}
+}
+
+/*
+ * Sobel, both kernels share the rows of the blurred image, and the magnitude
+ * and direction of EdgeGradient
+ */
+inline void edgeGradientStage(rowChannel<uint8_t> &in, rowChannel<directedPixel> &out, int rows, int cols) {
+	const int KERNEL_SIZE = 3;
+	rowHistory<uint8_t> history(KERNEL_SIZE, cols);
+	std::vector<int16_t> gradX(history.end()), gradY(history.end());
+	for (int y = 0; y < rows; y++) {
+		history.push(in.front());
+		in.pop();
+		simd::convSpan<sobelXKernel>(history.data(), &gradX[0], history.begin(), history.end(), cols);
+		simd::convSpan<sobelYKernel>(history.data(), &gradY[0], history.begin(), history.end(), cols);
+		directedPixel *row = out.claim();
+		bool inside = KERNEL_SIZE < y && y < rows - KERNEL_SIZE;
+		for (int x = 0; x < cols; x++) {
+			int gx = gradX[history.begin() + x];
+			int gy = gradY[history.begin() + x];
+			if (inside && KERNEL_SIZE < x && x < cols - KERNEL_SIZE)
+				row[x].set(gradientMagnitude(gx, gy), gradientDirection(gx, gy));
+			else
+				row[x].set(0, gradientDirection(gx, gy));
+		}
+		out.push();
+	}
+}
+
+/* NonMaxSuppression reaches 2 rows and 2 pixels back */
+inline void edgeSuppressStage(rowChannel<directedPixel> &in, rowChannel<uint8_t> &out, int rows, int cols) {
+	const int WINDOW_SIZE = 3;
+	rowHistory<directedPixel> history(WINDOW_SIZE - 1, cols);
+	directedPixel window_buf[WINDOW_SIZE][WINDOW_SIZE];
+	for (int y = 0; y < rows; y++) {
+		history.push(in.front());
+		in.pop();
+		uint8_t *row = out.claim();
+		bool inside = WINDOW_SIZE < y && y < rows - WINDOW_SIZE;
+		for (int x = 0; x < cols; x++) {
+			if (!inside || x <= WINDOW_SIZE || x >= cols - WINDOW_SIZE) {
+				row[x] = 0;
+				continue;
+			}
+			for (int i = 0; i < WINDOW_SIZE; i++)
+				for (int j = 0; j < WINDOW_SIZE; j++)
+					window_buf[i][j] = history.data()[i * cols + x - WINDOW_SIZE + 1 + j];
+			row[x] = edgeSuppressAt(window_buf);
+		}
+		out.push();
+	}
+}
+
+/*
+ * Hysteresis row by row. Its rows are HYSTERESIS_ROWS + 1 behind, so the
+ * stage takes that many rows more than it gives before its first output.
+ */
+template<int WIDTH, int HEIGHT>
+void hysteresisStage(rowChannel<uint8_t> &in, rowChannel<uint8_t> &out,
+		uint8_t low, uint8_t high, int rows, int cols) {
+	const int ROWS = HYSTERESIS_ROWS;
+	std::unique_ptr<hysteresisLabels<WIDTH, ROWS> > labels(new hysteresisLabels<WIDTH, ROWS>());
+	labels->reset();
+	int slot = 0;
+	for (int y = 0; y < rows + ROWS + 1; y++) {
+		const uint8_t *src = y < rows ? in.front() : 0;
+		uint8_t *dst = y > ROWS ? out.claim() : 0;
+		slot = hysteresisRow<WIDTH,HEIGHT>(*labels, y, slot, src, 0, dst, 0, low, high, rows, cols);
+		if (src)
+			in.pop();
+		if (dst)
+			out.push();
+	}
+}
+
+/* ZeroBorder and ArrayToMat */
+inline void borderStage(rowChannel<uint8_t> &in, RGB_IMAGE &dst, int size, int rows, int cols) {
+	hls::Scalar<3,uint8_t> pixel_value;
+	for (int y = 0; y < rows; y++) {
+		const uint8_t *row = in.front();
+		bool inside = size < y && y < rows - size;
+		for (int x = 0; x < cols; x++) {
+			uint8_t pix = inside && size < x && x < cols - size ? row[x] : 0;
+			for (int c = 0; c < 3; c++)
+				pixel_value.val[c] = pix;
+			dst << pixel_value;
+		}
+		in.pop();
+	}
+}
+
+/**
+ * Harris Corner detector with one thread per stage
+ *
+ * Gives the same result as imgProc::harris. decide needs the maximum of
+ * the whole frame, so the ring between MinMax and decide is a frame deep,
+ * like the min_max FIFO has to be in hardware; all others are
+ * DATAFLOW_DEPTH rows. report, if given, receives the fill of every ring.
+ */
+template<int WIDTH, int HEIGHT>
+void harris(RGB_IMAGE &src, weightPixel *dst, int thresUp, int rows = HEIGHT,
+		int cols = WIDTH, std::vector<channelReport> *report = 0) {
+	const int d = DATAFLOW_DEPTH;
+	rowChannel<uint8_t> gray(d, cols), blur(d, cols), blurX(d, cols), blurY(d, cols);
+	rowChannel<int16_t> gradX(d, cols), gradY(d, cols);
+	rowChannel<int16_t> gradXX(d, cols), gradXY(d, cols), gradYY(d, cols), gradYX(d, cols);
+	rowChannel<uint32_t> xx(d, cols), yy(d, cols);
+	rowChannel<int32_t> xy(d, cols), response(d, cols), frame(rows, cols);
+	rowChannel<weightPixel> decided(d, cols);
+	std::promise<int32_t> max;
+	std::shared_future<int32_t> frameMax = max.get_future().share();
+
+	std::vector<std::function<void()> > stages;
+	stages.push_back([&] { grayStage<WIDTH,HEIGHT>(src, gray, rows, cols); });
+	stages.push_back([&] { convStage<gauss3Kernel>(gray, blur, rows, cols); });
+	stages.push_back([&] { forkStage(blur, blurY, blurX, rows, cols); });
+	stages.push_back([&] { convStage<sobelYKernel>(blurY, gradY, rows, cols); });
+	stages.push_back([&] { convStage<sobelXKernel>(blurX, gradX, rows, cols); });
+	stages.push_back([&] { forkStage(gradX, gradXX, gradXY, rows, cols); });
+	stages.push_back([&] { forkStage(gradY, gradYY, gradYX, rows, cols); });
+	stages.push_back([&] { mulStage(gradXX, gradXX, xx, rows, cols); });
+	stages.push_back([&] { mulStage(gradYY, gradYY, yy, rows, cols); });
+	stages.push_back([&] { mulStage(gradXY, gradYX, xy, rows, cols); });
+#if TENSOR_WINDOW > 1
+	rowChannel<uint32_t> sumXX(d, cols), sumYY(d, cols);
+	rowChannel<int32_t> sumXY(d, cols);
+	stages.push_back([&] { tensorStage(xx, sumXX, rows, cols); });
+	stages.push_back([&] { tensorStage(yy, sumYY, rows, cols); });
+	stages.push_back([&] { tensorStage(xy, sumXY, rows, cols); });
+	stages.push_back([&] { responseStage(sumXX, sumYY, sumXY, response, rows, cols); });
+#else
+	stages.push_back([&] { responseStage(xx, yy, xy, response, rows, cols); });
+#endif
+	stages.push_back([&] { maxStage(response, frame, max, rows, cols); });
+	stages.push_back([&] { decideStage(frame, decided, frameMax, thresUp, rows, cols); });
+	stages.push_back([&] { suppressStage(decided, dst, rows, cols); });
+
+	std::vector<std::thread> threads;
+	for (size_t i = 0; i < stages.size(); i++)
+		threads.push_back(std::thread(stages[i]));
+	for (size_t i = 0; i < threads.size(); i++)
+		threads[i].join();
+	HARRIS_FRAME(dst, rows * cols);
+
+	reportChannel(report, "gray", gray);
+	reportChannel(report, "blur", blur);
+	reportChannel(report, "blurY", blurY);
+	reportChannel(report, "blurX", blurX);
+	reportChannel(report, "gradY", gradY);
+	reportChannel(report, "gradX", gradX);
+	reportChannel(report, "gradXX", gradXX);
+	reportChannel(report, "gradXY", gradXY);
+	reportChannel(report, "gradYY", gradYY);
+	reportChannel(report, "gradYX", gradYX);
+	reportChannel(report, "xx", xx);
+	reportChannel(report, "yy", yy);
+	reportChannel(report, "xy", xy);
+#if TENSOR_WINDOW > 1
+	reportChannel(report, "sumXX", sumXX);
+	reportChannel(report, "sumYY", sumYY);
+	reportChannel(report, "sumXY", sumXY);
+#endif
+	reportChannel(report, "response", response);
+	reportChannel(report, "frame", frame);
+	reportChannel(report, "decided", decided);
+}
+
+/**
+ * Canny edge detector with one thread per stage
+ *
+ * Gives the same result as imgProc::canny. Hysteresis keeps its labels of
+ * the last HYSTERESIS_ROWS + 1 rows itself, the rings are all
+ * DATAFLOW_DEPTH rows. report, if given, receives the fill of every ring.
+ */
+template<int WIDTH, int HEIGHT>
+void canny(RGB_IMAGE &src, RGB_IMAGE &dst, int low, int high, int rows = HEIGHT,
+		int cols = WIDTH, std::vector<channelReport> *report = 0) {
+	const int d = DATAFLOW_DEPTH;
+	rowChannel<uint8_t> gray(d, cols), blur(d, cols), thin(d, cols), edges(d, cols);
+	rowChannel<directedPixel> gradient(d, cols);
+
+	std::vector<std::function<void()> > stages;
+	stages.push_back([&] { grayStage<WIDTH,HEIGHT>(src, gray, rows, cols); });
+	stages.push_back([&] { convStage<gauss3Kernel>(gray, blur, rows, cols); });
+	stages.push_back([&] { edgeGradientStage(blur, gradient, rows, cols); });
+	stages.push_back([&] { edgeSuppressStage(gradient, thin, rows, cols); });
+	stages.push_back([&] { hysteresisStage<WIDTH,HEIGHT>(thin, edges, low, high, rows, cols); });
+	stages.push_back([&] { borderStage(edges, dst, 5, rows, cols); });
+
+	std::vector<std::thread> threads;
+	for (size_t i = 0; i < stages.size(); i++)
+		threads.push_back(std::thread(stages[i]));
+	for (size_t i = 0; i < threads.size(); i++)
+		threads[i].join();
+
+	reportChannel(report, "gray", gray);
+	reportChannel(report, "blur", blur);
+	reportChannel(report, "gradient", gradient);
+	reportChannel(report, "thin", thin);
+	reportChannel(report, "edges", edges);
+}
+
+}
+}
+
+#endif
@@ -0,0 +1,341 @@
+#ifndef HARRIS_ENGINE_HPP
+#define HARRIS_ENGINE_HPP
+
+#include "harris_context.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+
+/*
+ * Asynchronous host front end of the detector.
+ *
+ * harris_top keeps its caller busy for the whole frame. A HarrisEngine takes
+ * a frame with submit() and returns at once. Three threads work on different
+ * frames at the same time: one turns the pixels into the grayscale frame, one
+ * runs the detector on a HarrisContext and one turns the dense frame into the
+ * corner list and delivers it. Results come out in the order the frames went
+ * in. At most capacity frames are between submit() and delivery, a frame
+ * beyond that waits for a place or is dropped, see enginePolicy.
+ */
+
+namespace imgProc {
+
+/* What submit() does with a frame while capacity frames are in flight */
+enum enginePolicy{engineBlock,engineDrop};
+
+enum frameOutcome{frameDone,frameDropped,frameRejected};
+
+/*
+ * A frame for the engine: 3 bytes per pixel in the channel order of
+ * RGB_IMAGE, one row after the other. This is the layout of a CV_8UC3 Mat,
+ * which IplImage2AXIvideo sends as it is.
+ */
+struct hostFrame{
+	std::vector<uint8_t> pixels;
+	int rows;
+	int cols;
+};
+
+/* Nanoseconds a frame spent in every step from submit() to delivery */
+struct frameLatency{
+	double queued;
+	double convert;
+	double detect;
+	double deliver;
+	double total;
+};
+
+/*
+ * Result of one frame. corners holds every corner of the dense frame in
+ * raster order, status counts the frame like FrameStatus does. A dropped or
+ * rejected frame has neither.
+ */
+struct harrisResult{
+	uint64_t frame;
+	frameOutcome outcome;
+	std::vector<cornerRecord> corners;
+	harrisStatus status;
+	frameLatency latency;
+};
+
+struct engineReport{
+	uint64_t submitted;
+	uint64_t delivered;
+	uint64_t dropped;
+	uint64_t rejected;
+	int highWater;
+	double meanLatency;
+	double worstLatency;
+};
+
+/**
+ * Harris Corner detector behind a bounded queue of frames
+ *
+ * Gives the corners of harris() with the same thresUp and target. A future
+ * from submit() is ready once the frame has been delivered, a callback runs
+ * on the delivery thread. Dropped and rejected frames complete inside
+ * submit(). The destructor finishes every frame that was taken.
+ */
+template<int WIDTH, int HEIGHT>
+class HarrisEngine {
+public:
+	typedef std::function<void(harrisResult &)> callback;
+
+	HarrisEngine(int thresUp, int capacity = 4, int policy = engineBlock, int target = 0)
+			: thresUp(thresUp), target(target), policy(policy), slots(capacity > 0 ? capacity : 1),
+			pending(0), latencySum(0), stats() {
+		for (size_t i = 0; i < slots.size(); i++)
+			idle.push_back(&slots[i]);
+		threads.push_back(std::thread(&HarrisEngine::convertFrames, this));
+		threads.push_back(std::thread(&HarrisEngine::detectFrames, this));
+		threads.push_back(std::thread(&HarrisEngine::deliverFrames, this));
+	}
+
+	~HarrisEngine() {
+		toConvert.close();
+		for (size_t i = 0; i < threads.size(); i++)
+			threads[i].join();
+	}
+
+	std::future<harrisResult> submit(hostFrame frame) {
+		std::unique_ptr<job> j(new job);
+		std::future<harrisResult> result = j->promise.get_future();
+		j->frame.pixels.swap(frame.pixels);
+		j->frame.rows = frame.rows;
+		j->frame.cols = frame.cols;
+		admit(j);
+		return result;
+	}
+
+	void submit(hostFrame frame, callback done) {
+		std::unique_ptr<job> j(new job);
+		j->done = done;
+		j->frame.pixels.swap(frame.pixels);
+		j->frame.rows = frame.rows;
+		j->frame.cols = frame.cols;
+		admit(j);
+	}
+
+	/* Waits until every frame taken so far has been delivered */
+	void flush() {
+		std::unique_lock<std::mutex> lock(admission);
+		while (pending != 0)
+			finished.wait(lock);
+	}
+
+	engineReport report() {
+		std::lock_guard<std::mutex> guard(admission);
+		engineReport r = stats;
+		r.meanLatency = r.delivered ? latencySum / r.delivered : 0;
+		return r;
+	}
+
+private:
+	typedef std::chrono::steady_clock clock;
+
+	/* Frame buffers of one frame in flight */
+	struct slot {
+		std::vector<uint8_t> gray;
+		std::vector<weightPixel> dense;
+	};
+
+	struct job {
+		hostFrame frame;
+		uint64_t sequence;
+		slot *buffers;
+		std::promise<harrisResult> promise;
+		callback done;
+		harrisResult result;
+		clock::time_point submitted, started, converted, detected;
+	};
+
+	/* Blocking queue between two steps, pop() fails once closed and empty */
+	class jobQueue {
+	public:
+		jobQueue() : closed(false) {
+		}
+
+		void push(std::unique_ptr<job> &j) {
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				jobs.push_back(std::move(j));
+			}
+			ready.notify_one();
+		}
+
+		bool pop(std::unique_ptr<job> &j) {
+			std::unique_lock<std::mutex> guard(lock);
+			while (jobs.empty() && !closed)
+				ready.wait(guard);
+			if (jobs.empty())
+				return false;
+			j = std::move(jobs.front());
+			jobs.pop_front();
+			return true;
+		}
+
+		void close() {
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				closed = true;
+			}
+			ready.notify_all();
+		}
+
+	private:
+		std::mutex lock;
+		std::condition_variable ready;
+		std::deque<std::unique_ptr<job> > jobs;
+		bool closed;
+	};
+
+	static double nanoseconds(clock::time_point begin, clock::time_point end) {
+		return std::chrono::duration<double, std::nano>(end - begin).count();
+	}
+
+	void admit(std::unique_ptr<job> &j) {
+		j->submitted = clock::now();
+		j->result = harrisResult();
+		hostFrame &f = j->frame;
+		bool fits = f.rows > 0 && f.rows <= HEIGHT && f.cols > 0 && f.cols <= WIDTH
+				&& f.pixels.size() >= (size_t) f.rows * f.cols * 3;
+		{
+			std::unique_lock<std::mutex> lock(admission);
+			j->sequence = stats.submitted++;
+			if (!fits) {
+				stats.rejected++;
+				j->result.outcome = frameRejected;
+			} else if (idle.empty() && policy == engineDrop) {
+				stats.dropped++;
+				j->result.outcome = frameDropped;
+			} else {
+				while (idle.empty())
+					released.wait(lock);
+				j->buffers = idle.back();
+				idle.pop_back();
+				pending++;
+				int inFlight = slots.size() - idle.size();
+				if (inFlight > stats.highWater)
+					stats.highWater = inFlight;
+			}
+		}
+		if (j->result.outcome != frameDone) {
+			complete(*j);
+			return;
+		}
+		toConvert.push(j);
+	}
+
+	void convertFrames() {
+		std::unique_ptr<job> j;
+		hls::Scalar<3,uint8_t> pixel_value;
+		while (toConvert.pop(j)) {
+			j->started = clock::now();
+			const int n = j->frame.rows * j->frame.cols;
+			const uint8_t *pixels = &j->frame.pixels[0];
+			slot &s = *j->buffers;
+			s.gray.resize(n);
+			s.dense.resize(n);
+			for (int i = 0; i < n; i++) {
+				for (int c = 0; c < 3; c++)
+					pixel_value.val[c] = pixels[3 * i + c];
+				s.gray[i] = grayPixel(pixel_value);
+			}
+			std::vector<uint8_t>().swap(j->frame.pixels);
+			j->converted = clock::now();
+			toDetect.push(j);
+		}
+		toDetect.close();
+	}
+
+	void detectFrames() {
+		std::unique_ptr<job> j;
+		while (toDetect.pop(j)) {
+			slot &s = *j->buffers;
+			context.runGray(&s.gray[0], &s.dense[0], thresUp, j->frame.rows, j->frame.cols, target);
+			j->detected = clock::now();
+			toDeliver.push(j);
+		}
+		toDeliver.close();
+	}
+
+	void deliverFrames() {
+		std::unique_ptr<job> j;
+		while (toDeliver.pop(j)) {
+			const int cols = j->frame.cols;
+			const int n = j->frame.rows * cols;
+			const weightPixel *dense = &j->buffers->dense[0];
+			harrisResult &r = j->result;
+			for (int i = 0; i < n; i++) {
+				if (dense[i].t() == corner) {
+					cornerRecord c;
+					c.x = i % cols;
+					c.y = i / cols;
+					c.score = dense[i].value();
+					c.level = 0;
+					c.last = false;
+					r.corners.push_back(c);
+					if (c.score > r.status.peak)
+						r.status.peak = c.score;
+				} else if (dense[i].t() == edge) {
+					r.status.edges++;
+				}
+			}
+			r.status.pixels = n;
+			r.status.corners = r.corners.size();
+			r.latency.queued = nanoseconds(j->submitted, j->started);
+			r.latency.convert = nanoseconds(j->started, j->converted);
+			r.latency.detect = nanoseconds(j->converted, j->detected);
+			r.latency.deliver = nanoseconds(j->detected, clock::now());
+			r.latency.total = nanoseconds(j->submitted, clock::now());
+			{
+				std::lock_guard<std::mutex> guard(admission);
+				idle.push_back(j->buffers);
+				r.status.frames = ++stats.delivered;
+				latencySum += r.latency.total;
+				if (r.latency.total > stats.worstLatency)
+					stats.worstLatency = r.latency.total;
+			}
+			released.notify_one();
+			complete(*j);
+			{
+				std::lock_guard<std::mutex> guard(admission);
+				pending--;
+			}
+			finished.notify_all();
+		}
+	}
+
+	void complete(job &j) {
+		j.result.frame = j.sequence;
+		if (j.result.outcome != frameDone)
+			j.result.latency.total = nanoseconds(j.submitted, clock::now());
+		if (j.done)
+			j.done(j.result);
+		else
+			j.promise.set_value(j.result);
+	}
+
+	const int thresUp;
+	const int target;
+	const int policy;
+	HarrisContext<WIDTH,HEIGHT> context;
+	std::vector<slot> slots;
+	std::vector<slot *> idle;
+	jobQueue toConvert, toDetect, toDeliver;
+	std::mutex admission;
+	std::condition_variable released;
+	std::condition_variable finished;
+	int pending;
+	double latencySum;
+	engineReport stats;
+	std::vector<std::thread> threads;
+};
+
+}
+
+#endif
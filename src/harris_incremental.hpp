@@ -0,0 +1,325 @@
+#ifndef HARRIS_INCREMENTAL_HPP
+#define HARRIS_INCREMENTAL_HPP
+
+#include "harris_simd.hpp"
+#include <algorithm>
+#include <vector>
+
+/*
+ * Incremental Harris for video from a fixed camera.
+ *
+ * Most of such a frame looks like it did before. While the frame is turned
+ * into grayscale every pixel is compared with the frame the cached results
+ * were computed from, and a tile where one moved by more than tolerance is
+ * marked. The stage chain only runs again over the marked tiles, grown by
+ * the reach of the windows behind them. Every other tile keeps its cached
+ * responses and corners. A tile is recomputed at least every maxAge frames,
+ * which bounds how old a result can get while tolerance hides slow changes.
+ * With tolerance 0 every frame is the one harris() gives.
+ *
+ * This is for CPU builds, the hardware streams every pixel anyway.
+ */
+
+/*
+ * Edge length of a tile in pixels.
+ */
+#ifndef INCREMENTAL_TILE
+#define INCREMENTAL_TILE 32
+#endif
+
+namespace imgProc {
+
+/**
+ * Harris Corner detector that recomputes only the tiles that changed
+ *
+ * Create it once per camera and hand it every frame. A frame of another size
+ * is computed in full.
+ */
+template<int WIDTH, int HEIGHT>
+class IncrementalHarris {
+public:
+	IncrementalHarris(int tolerance = 0, int maxAge = 30) : tolerance(tolerance),
+			maxAge(maxAge), rows(0), cols(0), tilesX(0), tilesY(0), high(0),
+			recomputed(0) {
+	}
+
+	void run(RGB_IMAGE &src, weightPixel *dst, int thresUp, int rows = HEIGHT, int cols = WIDTH) {
+		const int n = rows * cols;
+		bool full = rows != this->rows || cols != this->cols;
+		if (full)
+			resize(rows, cols);
+
+		HARRIS_STAGE(stageGray, n, n, convert(src));
+		refresh(full);
+		grow(dirty, front, FRONT_REACH);
+		grow(dirty, back, FRONT_REACH + 4);
+
+		HARRIS_STAGE(stageGauss, pixels(front), pixels(front), eachSpan(front, [&](int b, int e) {
+			simd::convSpan<gauss3Kernel>(&gray[0], &blur[0], b, e, cols);
+		}));
+		HARRIS_STAGE(stageSobel, pixels(front), pixels(front), eachSpan(front, [&](int b, int e) {
+			simd::convSpan<sobelYKernel>(&blur[0], &gradY[0], b, e, cols);
+			simd::convSpan<sobelXKernel>(&blur[0], &gradX[0], b, e, cols);
+		}));
+		HARRIS_STAGE(stageMul, 2*pixels(front), 3*pixels(front), eachSpan(front, [&](int b, int e) {
+			simd::mulSpan(&gradX[0], &gradX[0], &xx[0], b, e);
+			simd::mulSpan(&gradY[0], &gradY[0], &yy[0], b, e);
+			simd::mulSpan(&gradX[0], &gradY[0], &xy[0], b, e);
+		}));
+#if TENSOR_WINDOW > 1
+		HARRIS_STAGE(stageTensor, 3*pixels(front), 3*pixels(front), eachSpan(front, [&](int b, int e) {
+			simd::tensorSpan<TENSOR_WINDOW, TENSOR_GAUSSIAN>(&xx[0], &sumXX[0], b, e, cols);
+			simd::tensorSpan<TENSOR_WINDOW, TENSOR_GAUSSIAN>(&yy[0], &sumYY[0], b, e, cols);
+			simd::tensorSpan<TENSOR_WINDOW, TENSOR_GAUSSIAN>(&xy[0], &sumXY[0], b, e, cols);
+		}));
+		HARRIS_STAGE(stageResponse, 3*pixels(front), pixels(front), eachSpan(front, [&](int b, int e) {
+			simd::responseSpan(&sumXX[0], &sumYY[0], &sumXY[0], &response[0], b, e);
+		}));
+#else
+		HARRIS_STAGE(stageResponse, 3*pixels(front), pixels(front), eachSpan(front, [&](int b, int e) {
+			simd::responseSpan(&xx[0], &yy[0], &xy[0], &response[0], b, e);
+		}));
+#endif
+		int32_t max = 0;
+		HARRIS_STAGE(stageMinMax, pixels(front), 0, max = frameMax());
+
+		/* a new threshold changes the decision everywhere */
+		if (full || max - thresUp != high) {
+			high = max - thresUp;
+			front.assign(front.size(), 1);
+			back.assign(back.size(), 1);
+		}
+		HARRIS_STAGE(stageDecide, pixels(front), pixels(front), eachSpan(front, [&](int b, int e) {
+			simd::decideSpan(&response[0], &decided[0], b, e, 42, high);
+		}));
+		HARRIS_STAGE(stageSuppress, pixels(back), pixels(back), eachSpan(back, [&](int b, int e) {
+			suppress(b, e);
+		}));
+		memcpy(dst, &corners[0], n * sizeof(weightPixel));
+		HARRIS_FRAME(dst, n);
+	}
+
+	/* Tiles of a frame and how many of them the last frame recomputed */
+	int tiles() const {
+		return tilesX * tilesY;
+	}
+
+	int tilesRecomputed() const {
+		return recomputed;
+	}
+
+private:
+	enum { TILE = INCREMENTAL_TILE, FRONT_REACH = 2 + 2 + TENSOR_WINDOW - 1 };
+
+	void resize(int rows, int cols) {
+		const int n = rows * cols;
+		this->rows = rows;
+		this->cols = cols;
+		tilesX = (cols + TILE - 1) / TILE;
+		tilesY = (rows + TILE - 1) / TILE;
+		incoming.assign(n, 0);
+		gray.assign(n, 0);
+		blur.assign(n, 0);
+		gradX.assign(n, 0);
+		gradY.assign(n, 0);
+		xx.assign(n, 0);
+		yy.assign(n, 0);
+		xy.assign(n, 0);
+#if TENSOR_WINDOW > 1
+		sumXX.assign(n, 0);
+		sumYY.assign(n, 0);
+		sumXY.assign(n, 0);
+#endif
+		response.assign(n, 0);
+		decided.assign(n, weightPixel());
+		corners.assign(n, weightPixel());
+		change.assign(tiles(), 0);
+		dirty.assign(tiles(), 0);
+		age.assign(tiles(), 0);
+		tileMax.assign(tiles(), 0);
+	}
+
+	/* MatToGrayArray that also keeps the largest change of every tile */
+	void convert(RGB_IMAGE &src) {
+		hls::Scalar<3,uint8_t> pixel_value;
+		std::fill(change.begin(), change.end(), 0);
+		for (int y = 0; y < rows; y++) {
+			uint8_t *tileRow = &change[(y / TILE) * tilesX];
+			for (int x = 0; x < cols; x++) {
+				src >> pixel_value;
+				int i = x + y * cols;
+				uint8_t g = grayPixel(pixel_value);
+				uint8_t d = g > gray[i] ? g - gray[i] : gray[i] - g;
+				if (d > tileRow[x / TILE])
+					tileRow[x / TILE] = d;
+				incoming[i] = g;
+			}
+		}
+	}
+
+	/*
+	 * Picks the tiles to recompute and takes their pixels over. The ages
+	 * start apart by tile row, so the forced refreshes spread over maxAge
+	 * frames instead of coming all at once.
+	 */
+	void refresh(bool full) {
+		recomputed = 0;
+		for (int t = 0; t < tiles(); t++) {
+			bool stale = maxAge > 0 && age[t] + 1 >= maxAge;
+			dirty[t] = full || change[t] > tolerance || stale;
+			if (!dirty[t]) {
+				age[t]++;
+				continue;
+			}
+			age[t] = full && maxAge > 0 ? (t / tilesX) % maxAge : 0;
+			recomputed++;
+			int x0 = (t % tilesX) * TILE, x1 = std::min(x0 + TILE, cols);
+			int y0 = (t / tilesX) * TILE, y1 = std::min(y0 + TILE, rows);
+			for (int y = y0; y < y1; y++)
+				memcpy(&gray[x0 + y * cols], &incoming[x0 + y * cols], x1 - x0);
+		}
+	}
+
+	/*
+	 * Marks the tiles whose output a marked tile reaches: reach rows down and
+	 * reach pixels on along the linear index, which wraps into the start of
+	 * the next row past the right border.
+	 */
+	void grow(const std::vector<uint8_t> &from, std::vector<uint8_t> &to, int reach) {
+		to.assign(tiles(), 0);
+		if (reach >= cols) {
+			for (int t = 0; t < tiles(); t++)
+				if (from[t]) {
+					to.assign(tiles(), 1);
+					return;
+				}
+			return;
+		}
+		for (int t = 0; t < tiles(); t++) {
+			if (!from[t])
+				continue;
+			int x0 = (t % tilesX) * TILE, x1 = std::min(x0 + TILE, cols) + reach;
+			int y0 = (t / tilesX) * TILE, y1 = std::min(y0 + TILE, rows) + reach;
+			mark(to, x0, y0, x1, y1);
+			if (x1 > cols)
+				mark(to, 0, y0 + 1, x1 - cols, y1 + 1);
+		}
+	}
+
+	void mark(std::vector<uint8_t> &mask, int x0, int y0, int x1, int y1) {
+		x1 = std::min(x1, cols);
+		y1 = std::min(y1, rows);
+		for (int ty = y0 / TILE; ty * TILE < y1; ty++)
+			for (int tx = x0 / TILE; tx * TILE < x1; tx++)
+				mask[tx + ty * tilesX] = 1;
+	}
+
+	int pixels(const std::vector<uint8_t> &mask) {
+		int n = 0;
+		for (int t = 0; t < tiles(); t++)
+			if (mask[t])
+				n += (std::min((t % tilesX + 1) * TILE, cols) - (t % tilesX) * TILE)
+						* (std::min((t / tilesX + 1) * TILE, rows) - (t / tilesX) * TILE);
+		return n;
+	}
+
+	/*
+	 * Calls f(begin, end) for the linear spans of the marked tiles, one per
+	 * pixel row of a run of neighbouring tiles. A run over the full width
+	 * is a single span.
+	 */
+	template<typename F>
+	void eachSpan(const std::vector<uint8_t> &mask, F f) {
+		for (int ty = 0; ty < tilesY; ty++) {
+			int y0 = ty * TILE, y1 = std::min(y0 + TILE, rows);
+			for (int tx = 0; tx < tilesX; tx++) {
+				if (!mask[tx + ty * tilesX])
+					continue;
+				int run = tx;
+				while (run < tilesX && mask[run + ty * tilesX])
+					run++;
+				int x0 = tx * TILE, x1 = std::min(run * TILE, cols);
+				if (x0 == 0 && x1 == cols) {
+					f(y0 * cols, y1 * cols);
+				} else {
+					for (int y = y0; y < y1; y++)
+						f(x0 + y * cols, x1 + y * cols);
+				}
+				tx = run;
+			}
+		}
+	}
+
+	/* Largest response of the frame, from the cached maximum of every tile */
+	int32_t frameMax() {
+		int32_t max = 0;
+		for (int t = 0; t < tiles(); t++) {
+			if (front[t]) {
+				int x0 = (t % tilesX) * TILE, x1 = std::min(x0 + TILE, cols);
+				int y0 = (t / tilesX) * TILE, y1 = std::min(y0 + TILE, rows);
+				int32_t m = 0;
+				for (int y = y0; y < y1; y++)
+					m = simd::maxSpan(&response[0], x0 + y * cols, x1 + y * cols, m);
+				tileMax[t] = m;
+			}
+			if (tileMax[t] > max)
+				max = tileMax[t];
+		}
+		return max;
+	}
+
+	/*
+	 * suppressSpan works out the scores of the four rows above its span,
+	 * which only pays off for whole rows. A piece of a row takes the 5x5
+	 * window of every pixel instead.
+	 */
+	void suppress(int begin, int end) {
+		if (end - begin >= cols) {
+			simd::suppressSpan(&decided[0], &corners[0], begin, end, cols);
+			return;
+		}
+		for (int i = begin; i < end; i++) {
+			weightPixel center = simd::tap(&decided[0], i - 2 * cols - 2);
+			if (center.t() != corner) {
+				corners[i] = decided[i];
+				continue;
+			}
+			uint16_t max = 0;
+			for (int r = 0; r < 5; r++) {
+				for (int c = 0; c < 5; c++) {
+					weightPixel tmp = simd::tap(&decided[0], i - r * cols - c);
+					if (tmp.t() == corner && tmp.value() > max)
+						max = tmp.value();
+				}
+			}
+			if (center.value() == max)
+				corners[i].set(corner, max);
+			else
+				corners[i].set(flat, 0);
+		}
+	}
+
+	const int tolerance;
+	const int maxAge;
+	int rows, cols;
+	int tilesX, tilesY;
+	int32_t high;
+	int recomputed;
+	std::vector<uint8_t> incoming, gray, blur;
+	std::vector<int16_t> gradX, gradY;
+	std::vector<uint32_t> xx, yy;
+	std::vector<int32_t> xy;
+#if TENSOR_WINDOW > 1
+	std::vector<uint32_t> sumXX, sumYY;
+	std::vector<int32_t> sumXY;
+#endif
+	std::vector<int32_t> response;
+	std::vector<weightPixel> decided, corners;
+	std::vector<uint8_t> change, dirty, front, back;
+	std::vector<int> age;
+	std::vector<int32_t> tileMax;
+};
+
+}
+
+#endif
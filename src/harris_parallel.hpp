@@ -0,0 +1,244 @@
+#ifndef HARRIS_PARALLEL_HPP
+#define HARRIS_PARALLEL_HPP
+
+#include "harris_simd.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace imgProc {
+
+/*
+ * Work stealing thread pool. Every worker owns a deque, takes work from its
+ * front and steals from the back of the others when it runs dry.
+ */
+class threadPool {
+public:
+	explicit threadPool(int threads = 0) : queued(0), pending(0), stop(false) {
+		if (threads <= 0)
+			threads = std::thread::hardware_concurrency();
+		if (threads <= 0)
+			threads = 1;
+		for (int i = 0; i < threads; i++)
+			queues.push_back(std::unique_ptr<taskQueue>(new taskQueue));
+		for (int i = 0; i < threads; i++)
+			workers.push_back(std::thread(&threadPool::work, this, i));
+	}
+
+	~threadPool() {
+		{
+			std::lock_guard<std::mutex> guard(sleepLock);
+			stop = true;
+		}
+		wake.notify_all();
+		for (size_t i = 0; i < workers.size(); i++)
+			workers[i].join();
+	}
+
+	int size() const {
+		return workers.size();
+	}
+
+	/* Runs all tasks and returns once the last one has finished */
+	void run(std::vector<std::function<void()> > &tasks) {
+		if (tasks.empty())
+			return;
+		for (size_t i = 0; i < tasks.size(); i++) {
+			taskQueue &q = *queues[i % queues.size()];
+			std::lock_guard<std::mutex> guard(q.lock);
+			q.tasks.push_back(tasks[i]);
+		}
+		{
+			std::lock_guard<std::mutex> guard(sleepLock);
+			pending += tasks.size();
+			queued += tasks.size();
+		}
+		wake.notify_all();
+
+		std::unique_lock<std::mutex> lock(sleepLock);
+		while (pending != 0)
+			done.wait(lock);
+	}
+
+private:
+	struct taskQueue {
+		std::mutex lock;
+		std::deque<std::function<void()> > tasks;
+	};
+
+	bool take(int self, std::function<void()> &task) {
+		int n = queues.size();
+		for (int k = 0; k < n; k++) {
+			taskQueue &q = *queues[(self + k) % n];
+			std::lock_guard<std::mutex> guard(q.lock);
+			if (q.tasks.empty())
+				continue;
+			if (k == 0) {
+				task = q.tasks.front();
+				q.tasks.pop_front();
+			} else {
+				task = q.tasks.back();
+				q.tasks.pop_back();
+			}
+			queued--;
+			return true;
+		}
+		return false;
+	}
+
+	void work(int self) {
+		for (;;) {
+			std::function<void()> task;
+			if (take(self, task)) {
+				task();
+				std::lock_guard<std::mutex> guard(sleepLock);
+				if (--pending == 0)
+					done.notify_all();
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(sleepLock);
+			while (!stop && queued == 0)
+				wake.wait(lock);
+			if (stop)
+				return;
+		}
+	}
+
+	std::vector<std::unique_ptr<taskQueue> > queues;
+	std::vector<std::thread> workers;
+	std::mutex sleepLock;
+	std::condition_variable wake;
+	std::condition_variable done;
+	std::atomic<int> queued;
+	int pending;
+	bool stop;
+};
+
+namespace parallel {
+
+/*
+ * One horizontal band of the frame. The window stages only look back, so a
+ * band starts its work a halo before its first pixel: 2 rows + 2 pixels for
+ * Gauss3 and for the Sobel stage, 4 rows + 4 pixels for the 5x5 suppression
+ * and TENSOR_WINDOW - 1 rows and pixels for the tensor window.
+ * Everything inside the halo is thrown away.
+ */
+struct band {
+	int begin;
+	int end;
+	int start;
+	int32_t max;
+	std::vector<uint8_t> blur;
+	std::vector<int16_t> gradX, gradY;
+	std::vector<uint32_t> xx, yy;
+	std::vector<int32_t> xy;
+	std::vector<int32_t> response;
+	std::vector<weightPixel> decided;
+};
+
+inline void bandResponse(band &b, const uint8_t *gray, int cols) {
+	int n = b.end - b.start;
+	const uint8_t *in = gray + b.start;
+	b.blur.resize(n);
+	b.gradX.resize(n);
+	b.gradY.resize(n);
+	b.xx.resize(n);
+	b.yy.resize(n);
+	b.xy.resize(n);
+	b.response.resize(n);
+	simd::convSpan<gauss3Kernel>(in, &b.blur[0], 0, n, cols);
+	simd::convSpan<sobelXKernel>(&b.blur[0], &b.gradX[0], 0, n, cols);
+	simd::convSpan<sobelYKernel>(&b.blur[0], &b.gradY[0], 0, n, cols);
+	simd::mulSpan(&b.gradX[0], &b.gradX[0], &b.xx[0], 0, n);
+	simd::mulSpan(&b.gradY[0], &b.gradY[0], &b.yy[0], 0, n);
+	simd::mulSpan(&b.gradX[0], &b.gradY[0], &b.xy[0], 0, n);
+#if TENSOR_WINDOW > 1
+	std::vector<uint32_t> square(n);
+	std::vector<int32_t> cross(n);
+	square.swap(b.xx);
+	simd::tensorSpan<TENSOR_WINDOW, TENSOR_GAUSSIAN>(&square[0], &b.xx[0], 0, n, cols);
+	square.swap(b.yy);
+	simd::tensorSpan<TENSOR_WINDOW, TENSOR_GAUSSIAN>(&square[0], &b.yy[0], 0, n, cols);
+	cross.swap(b.xy);
+	simd::tensorSpan<TENSOR_WINDOW, TENSOR_GAUSSIAN>(&cross[0], &b.xy[0], 0, n, cols);
+#endif
+	simd::responseSpan(&b.xx[0], &b.yy[0], &b.xy[0], &b.response[0], 0, n);
+	b.max = simd::maxSpan(&b.response[0], b.begin - b.start, n, 0);
+}
+
+inline void bandSuppress(band &b, weightPixel *dst, int cols, int low, int high) {
+	int n = b.end - b.start;
+	b.decided.resize(n);
+	simd::decideSpan(&b.response[0], &b.decided[0], 0, n, low, high);
+	simd::suppressSpan(&b.decided[0], dst + b.start, b.begin - b.start, n, cols);
+}
+
+/**
+ * Harris Corner detector split into bands on a thread pool
+ *
+ * Gives the same result as simd::harris. The bands only meet once, to find
+ * the maximum response of the frame before decide. With HARRIS_STATS the
+ * whole front end of all bands counts as the response stage and decide
+ * plus suppression as the suppress stage.
+ */
+template<int WIDTH, int HEIGHT>
+void harris(RGB_IMAGE &src, weightPixel *dst, int thresUp, threadPool &pool,
+		int rows = HEIGHT, int cols = WIDTH) {
+	static uint8_t gray[WIDTH*HEIGHT];
+	const int HALO = 2 * (2 * cols + 2) + (4 * cols + 4)
+			+ (TENSOR_WINDOW - 1) * (cols + 1);
+	const int MIN_ROWS = 16;
+
+	HARRIS_STAGE(stageGray, rows * cols, rows * cols, simd::MatToGrayArray<WIDTH,HEIGHT>(src, gray, rows, cols));
+
+	int count = pool.size() * 4;
+	int step = (rows + count - 1) / count;
+	if (step < MIN_ROWS)
+		step = MIN_ROWS;
+	std::vector<band> bands;
+	for (int y = 0; y < rows; y += step) {
+		band b;
+		b.begin = y * cols;
+		b.end = (y + step < rows ? y + step : rows) * cols;
+		b.start = b.begin > HALO ? b.begin - HALO : 0;
+		bands.push_back(b);
+	}
+
+	std::vector<std::function<void()> > tasks;
+	for (size_t i = 0; i < bands.size(); i++) {
+		band *b = &bands[i];
+		tasks.push_back([b, cols] { bandResponse(*b, gray, cols); });
+	}
+	HARRIS_STAGE(stageResponse, rows * cols, rows * cols, pool.run(tasks));
+
+	int32_t max = 0;
+	for (size_t i = 0; i < bands.size(); i++)
+		if (bands[i].max > max)
+			max = bands[i].max;
+
+	tasks.clear();
+	for (size_t i = 0; i < bands.size(); i++) {
+		band *b = &bands[i];
+		int high = max - thresUp;
+		tasks.push_back([b, dst, cols, high] { bandSuppress(*b, dst, cols, 42, high); });
+	}
+	HARRIS_STAGE(stageSuppress, rows * cols, rows * cols, pool.run(tasks));
+	HARRIS_FRAME(dst, rows * cols);
+}
+
+template<int WIDTH, int HEIGHT>
+void harris(RGB_IMAGE &src, weightPixel *dst, int thresUp,
+		int rows = HEIGHT, int cols = WIDTH) {
+	static threadPool pool;
+	harris<WIDTH,HEIGHT>(src, dst, thresUp, pool, rows, cols);
+}
+
+}
+}
+
+#endif
@@ -0,0 +1,419 @@
+#ifndef HARRIS_PPC_HPP
+#define HARRIS_PPC_HPP
+
+#include "harris.hpp"
+
+/*
+ * Pixels per clock of the wide pipeline, 1, 2, 4 or 8. 4K60 takes about
+ * 500 Mpixel/s, which 8 pixels per clock reach above 63 MHz; 4 need a
+ * clock above 125 MHz. cols has to be a multiple of it, harris_ppc_top
+ * rounds it down.
+ */
+#ifndef HARRIS_PPC
+#define HARRIS_PPC 8
+#endif
+
+/*
+ * Largest frame of harris_ppc_top, 4K by default and independent of
+ * MAX_WIDTH x MAX_HEIGHT.
+ */
+#ifndef PPC_MAX_WIDTH
+#define PPC_MAX_WIDTH  3840
+#endif
+#ifndef PPC_MAX_HEIGHT
+#define PPC_MAX_HEIGHT 2160
+#endif
+
+namespace imgProc {
+
+typedef hls::stream<ap_axiu<32*HARRIS_PPC,1,1,1> > AXI_WIDE_STREAM;
+
+/* PPC adjacent pixels of a row, the leftmost one in px[0] */
+template<typename T, int PPC>
+struct pixelPack {
+	T px[PPC];
+};
+
+/*
+ * Line buffer and window of a K x K stage that takes PPC pixels per step.
+ * The window holds the K - 1 pixels in front of the pack and the pack
+ * itself, so the window of pixel j of the pack starts at column j and the
+ * *At helpers give the same result as the single pixel stages.
+ */
+template<typename T, int K, int PPC, int WIDTH>
+struct packWindow {
+	pixelPack<T,PPC> line_buf[K][WIDTH/PPC];
+	T window_buf[K][PPC+K-1];
+
+	void reset() {
+		T zero = T();
+		for (int i = 0; i < K; i++) {
+			for (int j = 0; j < PPC + K - 1; j++)
+				window_buf[i][j] = zero;
+			for (int x = 0; x < WIDTH / PPC; x++)
+				for (int j = 0; j < PPC; j++)
+					line_buf[i][x].px[j] = zero;
+		}
+	}
+
+	void step(int x, const pixelPack<T,PPC> &in) {
+		for (int i = 0; i < K - 1; i++)
+			line_buf[i][x] = line_buf[i + 1][x];
+		line_buf[K - 1][x] = in;
+
+		for (int yw = 0; yw < K; yw++) {
+			for (int xw = 0; xw < K - 1; xw++) {
+				window_buf[yw][xw] = window_buf[yw][xw + PPC];
+			}
+		}
+		for (int yw = 0; yw < K; yw++)
+			for (int j = 0; j < PPC; j++)
+				window_buf[yw][K - 1 + j] = line_buf[yw][x].px[j];
+	}
+};
+
+/**
+ * Reads PPC pixels per beat from a wide AXI stream, pixel j in bits
+ * 32j..32j+23 in the channel order of AXIvideo2Mat, and converts them to
+ * gray. Waits for the start of frame in user like AXIvideo2Mat.
+ */
+template<int WIDTH, int HEIGHT, int PPC>
+void AXIToGrayArray(hls::stream<ap_axiu<32*PPC,1,1,1> > &in, pixelPack<uint8_t,PPC> *out, int rows = HEIGHT, int cols = WIDTH) {
+	ap_axiu<32*PPC,1,1,1> beat;
+	hls::Scalar<3,uint8_t> pixel_value;
+	const int packs = cols / PPC;
+
+	waitStart: do {
+#pragma HLS LOOP_TRIPCOUNT max=1
+		in >> beat;
+	} while (!beat.user);
+
+	loopPixel: for (int y = 0; y < rows; y++) {
+#pragma HLS LOOP_TRIPCOUNT max=HEIGHT
+		for (int x = 0; x < packs; x++) {
+#pragma HLS LOOP_TRIPCOUNT max=WIDTH/PPC
+#pragma HLS loop_flatten off
+#pragma HLS pipeline II=1
+			if (x != 0 || y != 0)
+				in >> beat;
+			pixelPack<uint8_t,PPC> gray;
+			for (int j = 0; j < PPC; j++) {
+				for (int c = 0; c < 3; c++)
+					pixel_value.val[c] = beat.data.range(32 * j + 8 * c + 7, 32 * j + 8 * c);
+				gray.px[j] = grayPixel(pixel_value);
+			}
+			out[x + y * packs] = gray;
+		}
+	}
+}
+
+template<int WIDTH, int HEIGHT, int PPC>
+void Gauss3(pixelPack<uint8_t,PPC> *imageIn, pixelPack<uint8_t,PPC> *imageOut, int rows = HEIGHT, int cols = WIDTH) {
+	packWindow<uint8_t, 3, PPC, WIDTH> win;
+#pragma HLS ARRAY_RESHAPE variable=win.line_buf complete dim=1
+#pragma HLS ARRAY_PARTITION variable=win.window_buf complete dim=0
+	const int packs = cols / PPC;
+	win.reset();
+
+	gaussLoop: for (int y = 0; y < rows; y++) {
+#pragma HLS LOOP_TRIPCOUNT max=HEIGHT
+		for (int x = 0; x < packs; x++) {
+#pragma HLS LOOP_TRIPCOUNT max=WIDTH/PPC
+#pragma HLS PIPELINE II=1
+#pragma HLS LOOP_FLATTEN off
+			pixelPack<uint8_t,PPC> out;
+			win.step(x, imageIn[x + y * packs]);
+			for (int j = 0; j < PPC; j++)
+				out.px[j] = gauss3At(win.window_buf, j);
+			imageOut[x + y * packs] = out;
+		}
+	}
+}
+
+template<int WIDTH, int HEIGHT, int PPC>
+void SobelX(pixelPack<uint8_t,PPC> *imageIn, pixelPack<gradient_t,PPC> *imageOut, int rows = HEIGHT, int cols = WIDTH) {
+	packWindow<uint8_t, 3, PPC, WIDTH> win;
+#pragma HLS ARRAY_RESHAPE variable=win.line_buf complete dim=1
+#pragma HLS ARRAY_PARTITION variable=win.window_buf complete dim=0
+	const int packs = cols / PPC;
+	win.reset();
+
+	sobelLoop: for (int y = 0; y < rows; y++) {
+#pragma HLS LOOP_TRIPCOUNT max=HEIGHT
+		for (int x = 0; x < packs; x++) {
+#pragma HLS LOOP_TRIPCOUNT max=WIDTH/PPC
+#pragma HLS PIPELINE II=1
+#pragma HLS LOOP_FLATTEN off
+			pixelPack<gradient_t,PPC> out;
+			win.step(x, imageIn[x + y * packs]);
+			for (int j = 0; j < PPC; j++)
+				out.px[j] = sobelXAt(win.window_buf, j);
+			imageOut[x + y * packs] = out;
+		}
+	}
+}
+
+template<int WIDTH, int HEIGHT, int PPC>
+void SobelY(pixelPack<uint8_t,PPC> *imageIn, pixelPack<gradient_t,PPC> *imageOut, int rows = HEIGHT, int cols = WIDTH) {
+	packWindow<uint8_t, 3, PPC, WIDTH> win;
+#pragma HLS ARRAY_RESHAPE variable=win.line_buf complete dim=1
+#pragma HLS ARRAY_PARTITION variable=win.window_buf complete dim=0
+	const int packs = cols / PPC;
+	win.reset();
+
+	sobelLoop: for (int y = 0; y < rows; y++) {
+#pragma HLS LOOP_TRIPCOUNT max=HEIGHT
+		for (int x = 0; x < packs; x++) {
+#pragma HLS LOOP_TRIPCOUNT max=WIDTH/PPC
+#pragma HLS PIPELINE II=1
+#pragma HLS LOOP_FLATTEN off
+			pixelPack<gradient_t,PPC> out;
+			win.step(x, imageIn[x + y * packs]);
+			for (int j = 0; j < PPC; j++)
+				out.px[j] = sobelYAt(win.window_buf, j);
+			imageOut[x + y * packs] = out;
+		}
+	}
+}
+
+template<int WIDTH, int HEIGHT, int PPC, typename T>
+void Dublicate(pixelPack<T,PPC> *imageIn, pixelPack<T,PPC> *imageOut1, pixelPack<T,PPC> *imageOut2, int rows = HEIGHT, int cols = WIDTH){
+	const int packs = cols / PPC;
+	for (int i = 0; i < rows * packs; i++) {
+#pragma HLS LOOP_TRIPCOUNT max=HEIGHT*WIDTH/PPC
+#pragma HLS PIPELINE II=1
+		pixelPack<T,PPC> v = imageIn[i];
+		imageOut1[i] = v;
+		imageOut2[i] = v;
+	}
+}
+
+template<int WIDTH, int HEIGHT, int PPC, typename T>
+void tripleSignal(pixelPack<T,PPC> *imageIn, pixelPack<T,PPC> *imageOut1, pixelPack<T,PPC> *imageOut2, pixelPack<T,PPC> *imageOut3, int rows = HEIGHT, int cols = WIDTH){
+	const int packs = cols / PPC;
+	for (int i = 0; i < rows * packs; i++) {
+#pragma HLS LOOP_TRIPCOUNT max=HEIGHT*WIDTH/PPC
+#pragma HLS PIPELINE II=1
+		pixelPack<T,PPC> v = imageIn[i];
+		imageOut1[i] = v;
+		imageOut2[i] = v;
+		imageOut3[i] = v;
+	}
+}
+
+template<int WIDTH, int HEIGHT, int PPC, typename T, typename P>
+void Mul(pixelPack<T,PPC> *image1, pixelPack<T,PPC> *image2, pixelPack<P,PPC> *imageOut, int rows = HEIGHT, int cols = WIDTH) {
+	const int packs = cols / PPC;
+	for (int i = 0; i < rows * packs; i++) {
+#pragma HLS LOOP_TRIPCOUNT max=HEIGHT*WIDTH/PPC
+#pragma HLS PIPELINE II=1
+		pixelPack<T,PPC> a = image1[i];
+		pixelPack<T,PPC> b = image2[i];
+		pixelPack<P,PPC> out;
+		for (int j = 0; j < PPC; j++)
+			out.px[j] = a.px[j] * b.px[j];
+		imageOut[i] = out;
+	}
+}
+
+/*
+ * Pixel j of every pack goes to bank j of the line buffers and column
+ * sums, so the PPC steps of one pack do not share a memory port.
+ */
+template<int WIDTH, int HEIGHT, int K_SIZE, bool GAUSSIAN, int PPC>
+void TensorWindow(pixelPack<square_t,PPC> *sobelXX, pixelPack<square_t,PPC> *sobelYY, pixelPack<cross_t,PPC> *sobelXY,
+		pixelPack<square_t,PPC> *sumXX, pixelPack<square_t,PPC> *sumYY, pixelPack<cross_t,PPC> *sumXY, int rows = HEIGHT, int cols = WIDTH) {
+	static tensorSum<WIDTH, K_SIZE, GAUSSIAN, square_t> xx, yy;
+	static tensorSum<WIDTH, K_SIZE, GAUSSIAN, cross_t> xy;
+#pragma HLS ARRAY_RESHAPE variable=xx.line_buf complete dim=1
+#pragma HLS ARRAY_RESHAPE variable=yy.line_buf complete dim=1
+#pragma HLS ARRAY_RESHAPE variable=xy.line_buf complete dim=1
+#pragma HLS ARRAY_PARTITION variable=xx.line_buf cyclic factor=PPC dim=2
+#pragma HLS ARRAY_PARTITION variable=yy.line_buf cyclic factor=PPC dim=2
+#pragma HLS ARRAY_PARTITION variable=xy.line_buf cyclic factor=PPC dim=2
+#pragma HLS ARRAY_PARTITION variable=xx.col_sum cyclic factor=PPC dim=1
+#pragma HLS ARRAY_PARTITION variable=yy.col_sum cyclic factor=PPC dim=1
+#pragma HLS ARRAY_PARTITION variable=xy.col_sum cyclic factor=PPC dim=1
+	const int packs = cols / PPC;
+	xx.reset();
+	yy.reset();
+	xy.reset();
+
+	tensorLoop: for (int y = 0; y < rows; y++) {
+#pragma HLS LOOP_TRIPCOUNT max=HEIGHT
+		for (int x = 0; x < packs; x++) {
+#pragma HLS LOOP_TRIPCOUNT max=WIDTH/PPC
+#pragma HLS PIPELINE II=1
+#pragma HLS LOOP_FLATTEN off
+			pixelPack<square_t,PPC> inXX = sobelXX[x + y * packs];
+			pixelPack<square_t,PPC> inYY = sobelYY[x + y * packs];
+			pixelPack<cross_t,PPC> inXY = sobelXY[x + y * packs];
+			pixelPack<square_t,PPC> outXX, outYY;
+			pixelPack<cross_t,PPC> outXY;
+			for (int j = 0; j < PPC; j++) {
+				outXX.px[j] = xx.step(x * PPC + j, inXX.px[j]);
+				outYY.px[j] = yy.step(x * PPC + j, inYY.px[j]);
+				outXY.px[j] = xy.step(x * PPC + j, inXY.px[j]);
+			}
+			sumXX[x + y * packs] = outXX;
+			sumYY[x + y * packs] = outYY;
+			sumXY[x + y * packs] = outXY;
+		}
+	}
+}
+
+template<int WIDTH, int HEIGHT, int PPC>
+void ResponseCalc(pixelPack<square_t,PPC> *sobelXX, pixelPack<square_t,PPC> *sobelYY, pixelPack<cross_t,PPC> *sobelXY, pixelPack<response_t,PPC> *imageOut, int rows = HEIGHT, int cols = WIDTH){
+	const int packs = cols / PPC;
+	for (int i = 0; i < rows * packs; i++) {
+#pragma HLS LOOP_TRIPCOUNT max=HEIGHT*WIDTH/PPC
+#pragma HLS PIPELINE II=1
+		pixelPack<square_t,PPC> xx = sobelXX[i];
+		pixelPack<square_t,PPC> yy = sobelYY[i];
+		pixelPack<cross_t,PPC> xy = sobelXY[i];
+		pixelPack<response_t,PPC> out;
+		for (int j = 0; j < PPC; j++)
+			out.px[j] = responseAt(xx.px[j], yy.px[j], xy.px[j]);
+		imageOut[i] = out;
+	}
+}
+
+template<int WIDTH, int HEIGHT, int PPC>
+void MinMax(pixelPack<response_t,PPC> *imageIn, pixelPack<response_t,PPC> *imageOut, int32_t &max, int rows = HEIGHT, int cols = WIDTH) {
+	const int packs = cols / PPC;
+	for (int i = 0; i < rows * packs; i++) {
+#pragma HLS LOOP_TRIPCOUNT max=HEIGHT*WIDTH/PPC
+#pragma HLS PIPELINE II=1
+		pixelPack<response_t,PPC> v = imageIn[i];
+		for (int j = 0; j < PPC; j++)
+			if (v.px[j] > max)
+				max = v.px[j];
+		imageOut[i] = v;
+	}
+}
+
+template<int WIDTH, int HEIGHT, int PPC>
+void decide(pixelPack<response_t,PPC> *imageIn, pixelPack<weightPixel,PPC> *imageOut,int low,int high, int rows = HEIGHT, int cols = WIDTH){
+	const int packs = cols / PPC;
+	for (int i = 0; i < rows * packs; i++) {
+#pragma HLS LOOP_TRIPCOUNT max=HEIGHT*WIDTH/PPC
+#pragma HLS PIPELINE II=1
+		pixelPack<response_t,PPC> v = imageIn[i];
+		pixelPack<weightPixel,PPC> out;
+		for (int j = 0; j < PPC; j++)
+			out.px[j] = decideAt(v.px[j], low, high);
+		imageOut[i] = out;
+	}
+}
+
+template<int WIDTH, int HEIGHT, int PPC>
+void NonMaxSurpression(pixelPack<weightPixel,PPC> *imageIn, pixelPack<weightPixel,PPC> *imageOut, int rows = HEIGHT, int cols = WIDTH){
+	packWindow<weightPixel, 5, PPC, WIDTH> win;
+#pragma HLS ARRAY_RESHAPE variable=win.line_buf complete dim=1
+#pragma HLS ARRAY_PARTITION variable=win.window_buf complete dim=0
+	const int packs = cols / PPC;
+	win.reset();
+
+	for (int y = 0; y < rows; y++) {
+#pragma HLS LOOP_TRIPCOUNT max=HEIGHT
+		for (int x = 0; x < packs; x++) {
+#pragma HLS LOOP_TRIPCOUNT max=WIDTH/PPC
+#pragma HLS PIPELINE II=1
+#pragma HLS LOOP_FLATTEN off
+			pixelPack<weightPixel,PPC> cur = imageIn[x + y * packs];
+			pixelPack<weightPixel,PPC> out;
+			win.step(x, cur);
+			for (int j = 0; j < PPC; j++)
+				out.px[j] = suppressAt(win.window_buf, j, cur.px[j]);
+			imageOut[x + y * packs] = out;
+		}
+	}
+}
+
+/**
+ * Harris Corner detector with PPC pixels per clock
+ *
+ * Same stages and same result as harris(), every stage moves PPC adjacent
+ * pixels per cycle. At a 10 ns clock 4 pixels per clock carry 400 Mpx/s.
+ */
+template<int WIDTH, int HEIGHT, int PPC>
+void harrisPPC(hls::stream<ap_axiu<32*PPC,1,1,1> > &src, pixelPack<weightPixel,PPC> *dst,int thresUp, int rows = HEIGHT, int cols = WIDTH){
+
+#pragma HLS DATAFLOW
+	typedef pixelPack<uint8_t,PPC> pack8;
+	typedef pixelPack<gradient_t,PPC> packGradient;
+	typedef pixelPack<square_t,PPC> packSquare;
+	typedef pixelPack<cross_t,PPC> packCross;
+	typedef pixelPack<response_t,PPC> packResponse;
+	const int PACKS = WIDTH*HEIGHT/PPC;
+
+	static pack8 		fifo1[PACKS];
+	static pack8 		fifo2[PACKS];
+	static pack8 		fifo3[PACKS];
+	static pack8 		fifo4[PACKS];
+	static packGradient	SobelXFIFO[PACKS];
+	static packGradient	SobelYFIFO[PACKS];
+	static packGradient	fifo5[PACKS];
+	static packGradient	fifo6[PACKS];
+	static packGradient	fifo7[PACKS];
+	static packGradient	fifo8[PACKS];
+	static packGradient	fifo9[PACKS];
+	static packGradient	fifoA[PACKS];
+	static packSquare 	SobelXX[PACKS];
+	static packSquare 	SobelYY[PACKS];
+	static packCross 	SobelXY[PACKS];
+	static packResponse	Response[PACKS];
+	static pixelPack<weightPixel,PPC> harris[PACKS];
+	static packResponse	min_max[PACKS];
+
+	int32_t max=0;
+
+#pragma HLS STREAM variable=fifo1 depth=1 dim=1
+#pragma HLS STREAM variable=fifo2 depth=1 dim=1
+#pragma HLS STREAM variable=fifo3 depth=1 dim=1
+#pragma HLS STREAM variable=fifo4 depth=1 dim=1
+#pragma HLS STREAM variable=fifo5 depth=1 dim=1
+#pragma HLS STREAM variable=fifo6 depth=1 dim=1
+#pragma HLS STREAM variable=fifo7 depth=1 dim=1
+#pragma HLS STREAM variable=fifo8 depth=1 dim=1
+#pragma HLS STREAM variable=fifo9 depth=1 dim=1
+#pragma HLS STREAM variable=fifoA depth=1 dim=1
+#pragma HLS STREAM variable=SobelXX depth=1 dim=1
+#pragma HLS STREAM variable=SobelYY depth=1 dim=1
+#pragma HLS STREAM variable=SobelXY depth=1 dim=1
+#pragma HLS STREAM variable=Response depth=1 dim=1
+#pragma HLS STREAM variable=SobelXFIFO depth=1 dim=1
+#pragma HLS STREAM variable=SobelYFIFO depth=1 dim=1
+#pragma HLS STREAM variable=min_max depth=1 dim=1
+#pragma HLS STREAM variable=harris depth=1 dim=1
+
+	AXIToGrayArray<WIDTH,HEIGHT,PPC>(src,fifo1,rows,cols);
+	Gauss3<WIDTH,HEIGHT,PPC>(fifo1,fifo2,rows,cols);
+	Dublicate<WIDTH,HEIGHT,PPC>(fifo2,fifo3,fifo4,rows,cols);
+	SobelY<WIDTH,HEIGHT,PPC>(fifo3,SobelYFIFO,rows,cols);
+	SobelX<WIDTH,HEIGHT,PPC>(fifo4,SobelXFIFO,rows,cols);
+	tripleSignal<WIDTH,HEIGHT,PPC>(SobelXFIFO,fifo5,fifo6,fifo7,rows,cols);
+	tripleSignal<WIDTH,HEIGHT,PPC>(SobelYFIFO,fifo8,fifo9,fifoA,rows,cols);
+	Mul<WIDTH,HEIGHT,PPC>(fifo5,fifo6,SobelXX,rows,cols);
+	Mul<WIDTH,HEIGHT,PPC>(fifo8,fifo9,SobelYY,rows,cols);
+	Mul<WIDTH,HEIGHT,PPC>(fifo7,fifoA,SobelXY,rows,cols);
+#if TENSOR_WINDOW > 1
+	static packSquare 	SumXX[PACKS];
+	static packSquare 	SumYY[PACKS];
+	static packCross 	SumXY[PACKS];
+#pragma HLS STREAM variable=SumXX depth=1 dim=1
+#pragma HLS STREAM variable=SumYY depth=1 dim=1
+#pragma HLS STREAM variable=SumXY depth=1 dim=1
+	TensorWindow<WIDTH,HEIGHT,TENSOR_WINDOW,TENSOR_GAUSSIAN,PPC>(SobelXX,SobelYY,SobelXY,SumXX,SumYY,SumXY,rows,cols);
+	ResponseCalc<WIDTH,HEIGHT,PPC>(SumXX,SumYY,SumXY,Response,rows,cols);
+#else
+	ResponseCalc<WIDTH,HEIGHT,PPC>(SobelXX,SobelYY,SobelXY,Response,rows,cols);
+#endif
+	MinMax<WIDTH,HEIGHT,PPC>(Response,min_max,max,rows,cols);
+	decide<WIDTH,HEIGHT,PPC>(min_max,harris,42,max-thresUp,rows,cols);
+	NonMaxSurpression<WIDTH,HEIGHT,PPC>(harris,dst,rows,cols);
+}
+
+}
+
+#endif
@@ -0,0 +1,528 @@
+#ifndef HARRIS_SIMD_HPP
+#define HARRIS_SIMD_HPP
+
+#include "harris.hpp"
+#include <string.h>
+#include <vector>
+
+/*
+ * Software backend of the imgProc kernels for CPU builds.
+ *
+ * The kernels have the same template signatures as the ones in harris.hpp and
+ * give bit-identical results. Every window stage is written on the linear
+ * pixel index: the output at i reads the input at i - r*cols - c, exactly
+ * like the line buffer/window pair does when it wraps from one row into the
+ * next. Indices before the frame read as zero.
+ *
+ * With GCC >= 9 or clang the inner loops use vector extensions and work on
+ * LANES pixels at once, which maps onto AVX2 or NEON registers. Other
+ * compilers get the plain loops.
+ */
+
+#if defined(__GNUC__) && !defined(__SYNTHESIS__) && (defined(__clang__) || __GNUC__ >= 9)
+#define HARRIS_SIMD_VECTOR 1
+#endif
+
+namespace imgProc {
+namespace simd {
+
+const int LANES = 16;
+
+#ifdef HARRIS_SIMD_VECTOR
+typedef uint8_t  u8v  __attribute__((vector_size(LANES)));
+typedef uint16_t u16v __attribute__((vector_size(LANES * 2)));
+typedef int16_t  i16v __attribute__((vector_size(LANES * 2)));
+typedef int32_t  i32v __attribute__((vector_size(LANES * 4)));
+typedef uint32_t u32v __attribute__((vector_size(LANES * 4)));
+typedef int64_t  i64v __attribute__((vector_size(LANES * 8)));
+
+/*
+ * Vectors wider than 16 bytes go through references only. Passed or
+ * returned by value they change the ABI without AVX, which GCC warns about.
+ */
+template<typename V, typename T>
+inline void load(V &v, const T *p) {
+	memcpy(&v, p, sizeof(V));
+}
+
+template<typename V, typename T>
+inline void store(T *p, const V &v) {
+	memcpy(p, &v, sizeof(V));
+}
+#endif
+
+template<typename T>
+inline T tap(const T *in, int i) {
+	return i < 0 ? T() : in[i];
+}
+
+/* Causal K x K window sum ending at pixel i, not normalised */
+template<typename KERNEL>
+inline int convScalar(const uint8_t *in, int i, int cols) {
+	const int K_SIZE = KERNEL::SIZE;
+	int sum = 0;
+	for (int yw = 0; yw < K_SIZE; yw++)
+		for (int xw = 0; xw < K_SIZE; xw++)
+			sum += tap(in, i - (K_SIZE - 1 - yw) * cols - (K_SIZE - 1 - xw))
+					* KERNEL::tap(yw, xw);
+	return sum;
+}
+
+/* Column factor of a separable kernel applied to the column ending at j */
+template<typename KERNEL>
+inline int columnScalar(const uint8_t *in, int j, int cols) {
+	const int K_SIZE = KERNEL::SIZE;
+	int sum = 0;
+	for (int yw = 0; yw < K_SIZE; yw++)
+		sum += tap(in, j - (K_SIZE - 1 - yw) * cols) * kernelFactor<KERNEL,false>(yw);
+	return sum;
+}
+
+#ifdef HARRIS_SIMD_VECTOR
+/*
+ * Adds v * t on LANES values to sum as shifts and adds. All sums are taken
+ * modulo 2^16, which is enough for every kernel.
+ */
+inline void shiftAdd(u16v &sum, const u16v &v, int t) {
+	int m = t < 0 ? -t : t;
+	u16v product = u16v();
+	for (int b = 0; b < 16; b++)
+		if (m & (1 << b))
+			product += v << b;
+	sum += t < 0 ? -product : product;
+}
+
+/* Adds LANES pixels ending at p, widened to 16 bits, times t to sum */
+inline void shiftAddPixels(u16v &sum, const uint8_t *p, int t) {
+	u8v v;
+	load(v, p);
+	shiftAdd(sum, __builtin_convertvector(v, u16v), t);
+}
+
+/* Same sum as convScalar for LANES pixels */
+template<typename KERNEL>
+inline void convVector(u16v &sum, const uint8_t *in, int i, int cols) {
+	const int K_SIZE = KERNEL::SIZE;
+	sum = u16v();
+	for (int yw = 0; yw < K_SIZE; yw++) {
+		for (int xw = 0; xw < K_SIZE; xw++) {
+			if (KERNEL::tap(yw, xw) == 0)
+				continue;
+			const uint8_t *p = in + i - (K_SIZE - 1 - yw) * cols - (K_SIZE - 1 - xw);
+			shiftAddPixels(sum, p, KERNEL::tap(yw, xw));
+		}
+	}
+}
+
+/* Same sum as columnScalar for LANES columns */
+template<typename KERNEL>
+inline void columnVector(u16v &sum, const uint8_t *in, int j, int cols) {
+	const int K_SIZE = KERNEL::SIZE;
+	sum = u16v();
+	for (int yw = 0; yw < K_SIZE; yw++) {
+		if (kernelFactor<KERNEL,false>(yw) == 0)
+			continue;
+		const uint8_t *p = in + j - (K_SIZE - 1 - yw) * cols;
+		shiftAddPixels(sum, p, kernelFactor<KERNEL,false>(yw));
+	}
+}
+
+/* Stores the shifted sums as blurred pixels or as signed gradients */
+template<int SHIFT>
+inline void storeSum(uint8_t *p, const u16v &sum) {
+	u8v narrow = __builtin_convertvector(sum >> SHIFT, u8v);
+	store(p, narrow);
+}
+
+template<int SHIFT>
+inline void storeSum(int16_t *p, const u16v &sum) {
+	i16v gradient = (i16v) sum >> SHIFT;
+	store(p, gradient);
+}
+#endif
+
+/*
+ * Convolution of out[begin..end) with the kernel descriptor KERNEL. T is
+ * uint8_t for the Gauss stages and int16_t for the gradients, which hold
+ * gradient_t exactly. Separable kernels take the column sums of the span
+ * first and then run the row factor over them, like Convolve does.
+ */
+template<typename KERNEL, typename T>
+void convSpan(const uint8_t *in, T *out, int begin, int end, int cols) {
+	typedef kernelTraits<KERNEL> traits;
+	const int K_SIZE = KERNEL::SIZE;
+	const int SHIFT = traits::SHIFT;
+	const int reach = (K_SIZE - 1) * cols + K_SIZE - 1;
+	if (begin >= end)
+		return;
+	int i = begin;
+	if (!traits::SEPARABLE) {
+#ifdef HARRIS_SIMD_VECTOR
+		for (; i < end && i < reach; i++)
+			out[i] = convScalar<KERNEL>(in, i, cols) >> SHIFT;
+		for (; i + LANES <= end; i += LANES) {
+			u16v sum;
+			convVector<KERNEL>(sum, in, i, cols);
+			storeSum<SHIFT>(out + i, sum);
+		}
+#endif
+		for (; i < end; i++)
+			out[i] = convScalar<KERNEL>(in, i, cols) >> SHIFT;
+		return;
+	}
+
+	int lo = begin - (K_SIZE - 1);
+	std::vector<int16_t> column(end - lo);
+	int j = lo;
+#ifdef HARRIS_SIMD_VECTOR
+	for (; j < end && j < (K_SIZE - 1) * cols; j++)
+		column[j - lo] = columnScalar<KERNEL>(in, j, cols);
+	for (; j + LANES <= end; j += LANES) {
+		u16v sum;
+		columnVector<KERNEL>(sum, in, j, cols);
+		store(&column[j - lo], sum);
+	}
+#endif
+	for (; j < end; j++)
+		column[j - lo] = columnScalar<KERNEL>(in, j, cols);
+
+#ifdef HARRIS_SIMD_VECTOR
+	for (; i + LANES <= end; i += LANES) {
+		u16v sum = u16v();
+		for (int xw = 0; xw < K_SIZE; xw++) {
+			u16v v;
+			load(v, &column[i - lo - (K_SIZE - 1 - xw)]);
+			shiftAdd(sum, v, kernelFactor<KERNEL,true>(xw));
+		}
+		storeSum<SHIFT>(out + i, sum);
+	}
+#endif
+	for (; i < end; i++)
+		out[i] = kernelDot<KERNEL,true>(&column[i - lo - (K_SIZE - 1)]) >> SHIFT;
+}
+
+inline void graySpan(const uint8_t *r, const uint8_t *g, const uint8_t *b,
+		uint8_t *out, int begin, int end) {
+	int i = begin;
+#ifdef HARRIS_SIMD_VECTOR
+	for (; i + LANES <= end; i += LANES) {
+		u8v rv, gv, bv;
+		load(rv, r + i);
+		load(gv, g + i);
+		load(bv, b + i);
+		u16v red = (__builtin_convertvector(rv, u16v) * 77) >> 8;
+		u16v green = (__builtin_convertvector(gv, u16v) * 150) >> 8;
+		u16v blue = (__builtin_convertvector(bv, u16v) * 28) >> 8;
+		u8v gray = __builtin_convertvector(red + green + blue, u8v);
+		store(out + i, gray);
+	}
+#endif
+	for (; i < end; i++) {
+		uint8_t red = (r[i] * 77) >> 8;
+		uint8_t green = (g[i] * 150) >> 8;
+		uint8_t blue = (b[i] * 28) >> 8;
+		out[i] = red + green + blue;
+	}
+}
+
+/* Gradient products, P is uint32_t for the squares and int32_t for Ix*Iy */
+template<typename P>
+void mulSpan(const int16_t *image1, const int16_t *image2,
+		P *imageOut, int begin, int end) {
+	int i = begin;
+#ifdef HARRIS_SIMD_VECTOR
+	for (; i + LANES <= end; i += LANES) {
+		i16v a, b;
+		load(a, image1 + i);
+		load(b, image2 + i);
+		i32v product = __builtin_convertvector(a, i32v) * __builtin_convertvector(b, i32v);
+		store(imageOut + i, product);
+	}
+#endif
+	for (; i < end; i++)
+		imageOut[i] = image1[i] * image2[i];
+}
+
+/*
+ * ResponseCalc. det and k*tra^2 need DET_BITS, so they are worked out in
+ * 64 bits and the response, RESPONSE_BITS wide, fits an int32_t again.
+ */
+inline void responseSpan(const uint32_t *sobelXX, const uint32_t *sobelYY,
+		const int32_t *sobelXY, int32_t *imageOut, int begin, int end) {
+	const int64_t k = RESPONSE_K;
+	int i = begin;
+#ifdef HARRIS_SIMD_VECTOR
+	for (; i + LANES <= end; i += LANES) {
+		u32v sxx, syy;
+		i32v sxy;
+		load(sxx, sobelXX + i);
+		load(syy, sobelYY + i);
+		load(sxy, sobelXY + i);
+		i64v xx = __builtin_convertvector(sxx, i64v);
+		i64v yy = __builtin_convertvector(syy, i64v);
+		i64v xy = __builtin_convertvector(sxy, i64v);
+		i64v tra = xx + yy;
+		i64v R = xx * yy - xy * xy - ((k * tra * tra) >> 16);
+		i32v response = __builtin_convertvector(R >> RESPONSE_SHIFT, i32v);
+		store(imageOut + i, response);
+	}
+#endif
+	for (; i < end; i++) {
+		int64_t xx = sobelXX[i], yy = sobelYY[i], xy = sobelXY[i];
+		int64_t tra = xx + yy;
+		int64_t R = xx * yy - xy * xy - ((k * tra * tra) >> 16);
+		imageOut[i] = R >> RESPONSE_SHIFT;
+	}
+}
+
+/*
+ * TensorWindow on the linear index, column sums first and then along the row.
+ */
+template<int K_SIZE, bool GAUSSIAN, typename T>
+void tensorSpan(const T *in, T *out, int begin, int end, int cols) {
+	if (begin >= end)
+		return;
+	int lo = begin - (K_SIZE - 1);
+	std::vector<int64_t> column(end - lo);
+	for (int j = lo; j < end; j++) {
+		int64_t sum = 0;
+		for (int r = 0; r < K_SIZE; r++)
+			sum += tensorTap(K_SIZE, GAUSSIAN, r) * tap(in, j - r * cols);
+		column[j - lo] = sum;
+	}
+	for (int i = begin; i < end; i++) {
+		int64_t sum = 0;
+		for (int c = 0; c < K_SIZE; c++)
+			sum += tensorTap(K_SIZE, GAUSSIAN, c) * column[i - lo - c];
+		out[i] = tensorNormalise<T>(K_SIZE, GAUSSIAN, sum);
+	}
+}
+
+inline int32_t maxSpan(const int32_t *imageIn, int begin, int end, int32_t max) {
+	int i = begin;
+#ifdef HARRIS_SIMD_VECTOR
+	if (i + LANES <= end) {
+		i32v m;
+		load(m, imageIn + i);
+		for (i += LANES; i + LANES <= end; i += LANES) {
+			i32v v;
+			load(v, imageIn + i);
+			m = v > m ? v : m;
+		}
+		for (int l = 0; l < LANES; l++)
+			if (m[l] > max)
+				max = m[l];
+	}
+#endif
+	for (; i < end; i++)
+		if (imageIn[i] > max)
+			max = imageIn[i];
+	return max;
+}
+
+inline void decideSpan(const int32_t *imageIn, weightPixel *imageOut,
+		int begin, int end, int low, int high) {
+	int i = begin;
+#ifdef HARRIS_SIMD_VECTOR
+	for (; i + LANES <= end; i += LANES) {
+		i32v v;
+		load(v, imageIn + i);
+		i32v isEdge = v < low;
+		i32v isCorner = v > high;
+		i32v value = isEdge ? (-v) >> 8 : (isCorner ? v >> 8 : i32v());
+		for (int l = 0; l < LANES; l++) {
+			imageOut[i + l].set(isEdge[l] ? edge : (isCorner[l] ? corner : flat), value[l]);
+		}
+	}
+#endif
+	for (; i < end; i++)
+		imageOut[i] = decideAt(imageIn[i], low, high);
+}
+
+/*
+ * NonMaxSurpression. The 5x5 maximum of the corner scores is separable, so it
+ * is taken along the rows first and then down the columns.
+ */
+inline void suppressSpan(const weightPixel *imageIn, weightPixel *imageOut,
+		int begin, int end, int cols) {
+	const int WINDOW_SIZE = 5;
+	const int reach = (WINDOW_SIZE - 1) * cols;
+	if (begin >= end)
+		return;
+	int lo = begin - reach - (WINDOW_SIZE - 1);
+	std::vector<uint16_t> score(end - lo, 0);
+	std::vector<uint16_t> rowMax(end - lo, 0);
+	for (int i = lo < 0 ? 0 : lo; i < end; i++)
+		if (imageIn[i].t() == corner)
+			score[i - lo] = imageIn[i].value();
+
+	int j = begin - reach;
+#ifdef HARRIS_SIMD_VECTOR
+	for (; j + LANES <= end; j += LANES) {
+		u16v m;
+		load(m, &score[j - lo]);
+		for (int c = 1; c < WINDOW_SIZE; c++) {
+			u16v v;
+			load(v, &score[j - lo - c]);
+			m = v > m ? v : m;
+		}
+		store(&rowMax[j - lo], m);
+	}
+#endif
+	for (; j < end; j++) {
+		uint16_t m = 0;
+		for (int c = 0; c < WINDOW_SIZE; c++)
+			if (score[j - lo - c] > m)
+				m = score[j - lo - c];
+		rowMax[j - lo] = m;
+	}
+
+	int i = begin;
+#ifdef HARRIS_SIMD_VECTOR
+	for (; i + LANES <= end; i += LANES) {
+		u16v m;
+		load(m, &rowMax[i - lo]);
+		for (int r = 1; r < WINDOW_SIZE; r++) {
+			u16v v;
+			load(v, &rowMax[i - lo - r * cols]);
+			m = v > m ? v : m;
+		}
+		for (int l = 0; l < LANES; l++) {
+			weightPixel center = tap(imageIn, i + l - 2 * cols - 2);
+			if (center.t() != corner) {
+				imageOut[i + l] = imageIn[i + l];
+			} else if (center.value() == m[l]) {
+				imageOut[i + l].set(corner, m[l]);
+			} else {
+				imageOut[i + l].set(flat, 0);
+			}
+		}
+	}
+#endif
+	for (; i < end; i++) {
+		uint16_t m = 0;
+		for (int r = 0; r < WINDOW_SIZE; r++)
+			if (rowMax[i - lo - r * cols] > m)
+				m = rowMax[i - lo - r * cols];
+		weightPixel center = tap(imageIn, i - 2 * cols - 2);
+		if (center.t() != corner) {
+			imageOut[i] = imageIn[i];
+		} else if (center.value() == m) {
+			imageOut[i].set(corner, m);
+		} else {
+			imageOut[i].set(flat, 0);
+		}
+	}
+}
+
+/*
+ * Drop-in replacements of the harris.hpp kernels
+ */
+template<int WIDTH, int HEIGHT>
+void MatToGrayArray(RGB_IMAGE &in, uint8_t* out, int rows = HEIGHT, int cols = WIDTH) {
+	static uint8_t plane[3][WIDTH * HEIGHT];
+	hls::Scalar<3,uint8_t> pixel_value;
+	for (int i = 0; i < rows * cols; i++) {
+		in >> pixel_value;
+		plane[0][i] = pixel_value.val[0];
+		plane[1][i] = pixel_value.val[1];
+		plane[2][i] = pixel_value.val[2];
+	}
+	graySpan(plane[0], plane[1], plane[2], out, 0, rows * cols);
+}
+
+template<int WIDTH, int HEIGHT>
+void Gauss3(uint8_t *imageIn, uint8_t *imageOut, int rows = HEIGHT, int cols = WIDTH) {
+	convSpan<gauss3Kernel>(imageIn, imageOut, 0, rows * cols, cols);
+}
+
+template<int WIDTH, int HEIGHT>
+void Gauss5(uint8_t *imageIn, uint8_t *imageOut, int rows = HEIGHT, int cols = WIDTH) {
+	convSpan<gauss5Kernel>(imageIn, imageOut, 0, rows * cols, cols);
+}
+
+template<int WIDTH, int HEIGHT>
+void SobelX(uint8_t *imageIn, int16_t *imageOut, int rows = HEIGHT, int cols = WIDTH) {
+	convSpan<sobelXKernel>(imageIn, imageOut, 0, rows * cols, cols);
+}
+
+template<int WIDTH, int HEIGHT>
+void SobelY(uint8_t *imageIn, int16_t *imageOut, int rows = HEIGHT, int cols = WIDTH) {
+	convSpan<sobelYKernel>(imageIn, imageOut, 0, rows * cols, cols);
+}
+
+template<int WIDTH, int HEIGHT, typename P>
+void Mul(int16_t *image1, int16_t *image2, P *imageOut, int rows = HEIGHT, int cols = WIDTH) {
+	mulSpan(image1, image2, imageOut, 0, rows * cols);
+}
+
+template<int WIDTH, int HEIGHT>
+void ResponseCalc(uint32_t *sobelXX, uint32_t *sobelYY, int32_t *sobelXY,int32_t *imageOut, int rows = HEIGHT, int cols = WIDTH) {
+	responseSpan(sobelXX, sobelYY, sobelXY, imageOut, 0, rows * cols);
+}
+
+template<int WIDTH, int HEIGHT>
+void MinMax(int32_t *imageIn, int32_t *imageOut, int32_t &max, int rows = HEIGHT, int cols = WIDTH) {
+	max = maxSpan(imageIn, 0, rows * cols, max);
+	memcpy(imageOut, imageIn, rows * cols * sizeof(int32_t));
+}
+
+template<int WIDTH, int HEIGHT>
+void decide(int32_t *imageIn, weightPixel *imageOut,int low,int high, int rows = HEIGHT, int cols = WIDTH) {
+	decideSpan(imageIn, imageOut, 0, rows * cols, low, high);
+}
+
+template<int WIDTH, int HEIGHT>
+void NonMaxSurpression(weightPixel *imageIn,weightPixel *imageOut, int rows = HEIGHT, int cols = WIDTH) {
+	suppressSpan(imageIn, imageOut, 0, rows * cols, cols);
+}
+
+/**
+ * Harris Corner detector on the software kernels
+ *
+ * Same stages as imgProc::harris, without the copies that only exist to fan
+ * data out in hardware.
+ */
+template<int WIDTH, int HEIGHT>
+void harris(RGB_IMAGE &src, weightPixel *dst,int thresUp, int rows = HEIGHT, int cols = WIDTH) {
+	static uint8_t 		gray[WIDTH*HEIGHT];
+	static uint8_t 		blur[WIDTH*HEIGHT];
+	static int16_t 		gradX[WIDTH*HEIGHT];
+	static int16_t 		gradY[WIDTH*HEIGHT];
+	static uint32_t 	SobelXX[WIDTH*HEIGHT];
+	static uint32_t 	SobelYY[WIDTH*HEIGHT];
+	static int32_t 		SobelXY[WIDTH*HEIGHT];
+	static int32_t 		Response[WIDTH*HEIGHT];
+	static weightPixel  decided[WIDTH*HEIGHT];
+
+	const int n = rows * cols;
+	int32_t max;
+
+	HARRIS_STAGE(stageGray, n, n, simd::MatToGrayArray<WIDTH,HEIGHT>(src,gray,rows,cols));
+	HARRIS_STAGE(stageGauss, n, n, simd::Gauss3<WIDTH,HEIGHT>(gray,blur,rows,cols));
+	HARRIS_STAGE(stageSobel, n, n, simd::SobelY<WIDTH,HEIGHT>(blur,gradY,rows,cols));
+	HARRIS_STAGE(stageSobel, n, n, simd::SobelX<WIDTH,HEIGHT>(blur,gradX,rows,cols));
+	HARRIS_STAGE(stageMul, 2*n, n, simd::Mul<WIDTH,HEIGHT>(gradX,gradX,SobelXX,rows,cols));
+	HARRIS_STAGE(stageMul, 2*n, n, simd::Mul<WIDTH,HEIGHT>(gradY,gradY,SobelYY,rows,cols));
+	HARRIS_STAGE(stageMul, 2*n, n, simd::Mul<WIDTH,HEIGHT>(gradX,gradY,SobelXY,rows,cols));
+#if TENSOR_WINDOW > 1
+	static uint32_t 	SumXX[WIDTH*HEIGHT];
+	static uint32_t 	SumYY[WIDTH*HEIGHT];
+	static int32_t 		SumXY[WIDTH*HEIGHT];
+	HARRIS_STAGE(stageTensor, n, n, tensorSpan<TENSOR_WINDOW, TENSOR_GAUSSIAN>(SobelXX, SumXX, 0, n, cols));
+	HARRIS_STAGE(stageTensor, n, n, tensorSpan<TENSOR_WINDOW, TENSOR_GAUSSIAN>(SobelYY, SumYY, 0, n, cols));
+	HARRIS_STAGE(stageTensor, n, n, tensorSpan<TENSOR_WINDOW, TENSOR_GAUSSIAN>(SobelXY, SumXY, 0, n, cols));
+	HARRIS_STAGE(stageResponse, 3*n, n, simd::ResponseCalc<WIDTH,HEIGHT>(SumXX,SumYY,SumXY,Response,rows,cols));
+#else
+	HARRIS_STAGE(stageResponse, 3*n, n, simd::ResponseCalc<WIDTH,HEIGHT>(SobelXX,SobelYY,SobelXY,Response,rows,cols));
+#endif
+	HARRIS_STAGE(stageMinMax, n, 0, max = simd::maxSpan(Response, 0, n, 0));
+	HARRIS_STAGE(stageDecide, n, n, simd::decide<WIDTH,HEIGHT>(Response,decided,42,max-thresUp,rows,cols));
+	HARRIS_STAGE(stageSuppress, n, n, simd::NonMaxSurpression<WIDTH,HEIGHT>(decided,dst,rows,cols));
+	HARRIS_FRAME(dst, n);
+}
+
+}
+}
+
+#endif
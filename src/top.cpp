@@ -1,20 +1,301 @@
 #include "../src/top.hpp"
 
 /*
- * Harris Edge detection
+ * rows and cols come straight from AXI-Lite. Every top bounds them to
+ * 1..MAX_HEIGHT and 1..MAX_WIDTH before they reach a stage, so a bad value
+ * can neither index past the frame buffers nor give an empty frame.
  */
-void harris_top(AXI_STREAM &Stream_IN,weightPixel *Stream_OUT,int thresUp){
+static int clampSize(int size, int max){
+	if (size < 1)
+		return 1;
+	if (size > max)
+		return max;
+	return size;
+}
+
+/*
+ * Harris Edge detection. rows and cols give the frame size, clamped to
+ * MAX_HEIGHT x MAX_WIDTH. status counts the frames and corners of the last
+ * complete frame. pixelsIn and pixelsOut count the pixels of the current
+ * frame that entered and left the detector while it runs.
+ *
+ * Built with -DHARRIS_STREAMING, this top and the sparse and grid tops run
+ * harrisStreaming instead of harris: no frame buffer, but every frame is
+ * thresholded with the maximum response of the frame before it, so the
+ * first frame gives no corners.
+ */
+void harris_top(AXI_STREAM &Stream_IN,weightPixel *Stream_OUT,int thresUp,int rows,int cols,harrisStatus &status,volatile uint32_t &pixelsIn,volatile uint32_t &pixelsOut){
 #pragma HLS INTERFACE ap_ctrl_none port=return
 #pragma HLS INTERFACE s_axilite port=thresUp
+#pragma HLS INTERFACE s_axilite port=rows
+#pragma HLS INTERFACE s_axilite port=cols
+#pragma HLS INTERFACE s_axilite port=status
+#pragma HLS INTERFACE s_axilite port=pixelsIn
+#pragma HLS INTERFACE s_axilite port=pixelsOut
 #pragma HLS INTERFACE axis port=Stream_IN
 #pragma HLS INTERFACE axis port=Stream_OUT
 
+	rows = clampSize(rows, MAX_HEIGHT);
+	cols = clampSize(cols, MAX_WIDTH);
+
 #pragma HLS DATAFLOW
-	RGB_IMAGE 	img1(MAX_HEIGHT,MAX_WIDTH);
-	RGB_IMAGE 	img2(MAX_HEIGHT,MAX_WIDTH);
+	RGB_IMAGE 	img1(rows,cols);
+	RGB_IMAGE 	img2(rows,cols);
+	static weightPixel dense[MAX_WIDTH*MAX_HEIGHT];
+#pragma HLS STREAM variable=dense depth=1 dim=1
 
 	hls::AXIvideo2Mat(Stream_IN, img1);
-	harris<MAX_WIDTH,MAX_HEIGHT>(img1,Stream_OUT,thresUp);
-	//hls::Mat2AXIvideo(img2, Stream_OUT);
+	PixelProgress<MAX_WIDTH,MAX_HEIGHT>(img1,img2,pixelsIn,rows,cols);
+#ifdef HARRIS_STREAMING
+	harrisStreaming<MAX_WIDTH,MAX_HEIGHT>(img2,dense,thresUp,rows,cols);
+#else
+	harris<MAX_WIDTH,MAX_HEIGHT>(img2,dense,thresUp,rows,cols);
+#endif
+	FrameStatus<MAX_WIDTH,MAX_HEIGHT>(dense,Stream_OUT,status,pixelsOut,rows,cols);
+}
+
+
+/*
+ * Harris Edge detection on a luma stream, format is one of rawFormat. rows
+ * and cols give the size of the grayscale frame. status, pixelsIn and
+ * pixelsOut as for harris_top.
+ */
+void harris_raw_top(AXI_STREAM &Stream_IN,weightPixel *Stream_OUT,int thresUp,int format,int rows,int cols,harrisStatus &status,volatile uint32_t &pixelsIn,volatile uint32_t &pixelsOut){
+#pragma HLS INTERFACE ap_ctrl_none port=return
+#pragma HLS INTERFACE s_axilite port=thresUp
+#pragma HLS INTERFACE s_axilite port=format
+#pragma HLS INTERFACE s_axilite port=rows
+#pragma HLS INTERFACE s_axilite port=cols
+#pragma HLS INTERFACE s_axilite port=status
+#pragma HLS INTERFACE s_axilite port=pixelsIn
+#pragma HLS INTERFACE s_axilite port=pixelsOut
+#pragma HLS INTERFACE axis port=Stream_IN
+#pragma HLS INTERFACE axis port=Stream_OUT
+
+	rows = clampSize(rows, MAX_HEIGHT);
+	cols = clampSize(cols, MAX_WIDTH);
+
+#pragma HLS DATAFLOW
+	static uint8_t gray[MAX_WIDTH*MAX_HEIGHT];
+	static uint8_t luma[MAX_WIDTH*MAX_HEIGHT];
+	static weightPixel dense[MAX_WIDTH*MAX_HEIGHT];
+#pragma HLS STREAM variable=gray depth=1 dim=1
+#pragma HLS STREAM variable=luma depth=1 dim=1
+#pragma HLS STREAM variable=dense depth=1 dim=1
+
+	RawToGrayArray<MAX_WIDTH,MAX_HEIGHT>(Stream_IN,gray,format,rows,cols);
+	PixelProgress<MAX_WIDTH,MAX_HEIGHT>(gray,luma,pixelsIn,rows,cols);
+	harrisGray<MAX_WIDTH,MAX_HEIGHT>(luma,dense,thresUp,rows,cols);
+	FrameStatus<MAX_WIDTH,MAX_HEIGHT>(dense,Stream_OUT,status,pixelsOut,rows,cols);
 }
 
+/*
+ * Harris corner detection with a sparse corner list as output
+ */
+void harris_sparse_top(AXI_STREAM &Stream_IN,cornerRecord *Corners_OUT,int thresUp,uint16_t &count,int rows,int cols){
+#pragma HLS INTERFACE ap_ctrl_none port=return
+#pragma HLS INTERFACE s_axilite port=thresUp
+#pragma HLS INTERFACE s_axilite port=rows
+#pragma HLS INTERFACE s_axilite port=cols
+#pragma HLS INTERFACE s_axilite port=count
+#pragma HLS INTERFACE axis port=Stream_IN
+#pragma HLS INTERFACE axis port=Corners_OUT
+
+	rows = clampSize(rows, MAX_HEIGHT);
+	cols = clampSize(cols, MAX_WIDTH);
+
+#pragma HLS DATAFLOW
+	RGB_IMAGE 	img1(rows,cols);
+	static weightPixel dense[MAX_WIDTH*MAX_HEIGHT];
+#pragma HLS STREAM variable=dense depth=1 dim=1
+
+	hls::AXIvideo2Mat(Stream_IN, img1);
+#ifdef HARRIS_STREAMING
+	harrisStreaming<MAX_WIDTH,MAX_HEIGHT>(img1,dense,thresUp,rows,cols);
+#else
+	harris<MAX_WIDTH,MAX_HEIGHT>(img1,dense,thresUp,rows,cols);
+#endif
+	CornerList<MAX_WIDTH,MAX_HEIGHT,MAX_CORNERS>(dense,Corners_OUT,count,rows,cols);
+}
+
+/*
+ * Harris corner detection with the GRID_CORNERS strongest corners of every
+ * cell of a gridCols x gridRows grid as output
+ */
+void harris_grid_top(AXI_STREAM &Stream_IN,cornerRecord *Corners_OUT,int thresUp,int gridCols,int gridRows,uint16_t &count,int rows,int cols){
+#pragma HLS INTERFACE ap_ctrl_none port=return
+#pragma HLS INTERFACE s_axilite port=thresUp
+#pragma HLS INTERFACE s_axilite port=gridCols
+#pragma HLS INTERFACE s_axilite port=gridRows
+#pragma HLS INTERFACE s_axilite port=rows
+#pragma HLS INTERFACE s_axilite port=cols
+#pragma HLS INTERFACE s_axilite port=count
+#pragma HLS INTERFACE axis port=Stream_IN
+#pragma HLS INTERFACE axis port=Corners_OUT
+
+	rows = clampSize(rows, MAX_HEIGHT);
+	cols = clampSize(cols, MAX_WIDTH);
+
+#pragma HLS DATAFLOW
+	RGB_IMAGE 	img1(rows,cols);
+	static weightPixel dense[MAX_WIDTH*MAX_HEIGHT];
+#pragma HLS STREAM variable=dense depth=1 dim=1
+
+	hls::AXIvideo2Mat(Stream_IN, img1);
+#ifdef HARRIS_STREAMING
+	harrisStreaming<MAX_WIDTH,MAX_HEIGHT>(img1,dense,thresUp,rows,cols);
+#else
+	harris<MAX_WIDTH,MAX_HEIGHT>(img1,dense,thresUp,rows,cols);
+#endif
+	GridCornerList<MAX_WIDTH,MAX_HEIGHT,GRID_COLS,GRID_ROWS,GRID_CORNERS>(dense,Corners_OUT,count,gridCols,gridRows,rows,cols);
+}
+
+/*
+ * Harris corner detection that thresholds every frame so that at most
+ * target responses become corner candidates, whatever the scene. status,
+ * pixelsIn and pixelsOut as for harris_top. status.corners counts the
+ * output after the suppression, which forwards a candidate that is not the
+ * centre of its window as well, so it is at most 2 * target.
+ */
+void harris_count_top(AXI_STREAM &Stream_IN,weightPixel *Stream_OUT,int target,int rows,int cols,harrisStatus &status,volatile uint32_t &pixelsIn,volatile uint32_t &pixelsOut){
+#pragma HLS INTERFACE ap_ctrl_none port=return
+#pragma HLS INTERFACE s_axilite port=target
+#pragma HLS INTERFACE s_axilite port=rows
+#pragma HLS INTERFACE s_axilite port=cols
+#pragma HLS INTERFACE s_axilite port=status
+#pragma HLS INTERFACE s_axilite port=pixelsIn
+#pragma HLS INTERFACE s_axilite port=pixelsOut
+#pragma HLS INTERFACE axis port=Stream_IN
+#pragma HLS INTERFACE axis port=Stream_OUT
+
+	rows = clampSize(rows, MAX_HEIGHT);
+	cols = clampSize(cols, MAX_WIDTH);
+
+#pragma HLS DATAFLOW
+	RGB_IMAGE 	img1(rows,cols);
+	RGB_IMAGE 	img2(rows,cols);
+	static weightPixel dense[MAX_WIDTH*MAX_HEIGHT];
+#pragma HLS STREAM variable=dense depth=1 dim=1
+
+	hls::AXIvideo2Mat(Stream_IN, img1);
+	PixelProgress<MAX_WIDTH,MAX_HEIGHT>(img1,img2,pixelsIn,rows,cols);
+	harris<MAX_WIDTH,MAX_HEIGHT>(img2,dense,0,rows,cols,target);
+	FrameStatus<MAX_WIDTH,MAX_HEIGHT>(dense,Stream_OUT,status,pixelsOut,rows,cols);
+}
+
+/*
+ * Harris corner detection for video. The threshold follows the maximum
+ * response of the previous frames, so nothing is buffered. Set reset to
+ * start over, the next frame then only primes the threshold. A target
+ * above 0 replaces thresUp by the threshold that passes at most target
+ * responses of the previous frame.
+ */
+void harris_video_top(AXI_STREAM &Stream_IN,weightPixel *Stream_OUT,int thresUp,int target,int smoothShift,bool reset,int rows,int cols){
+#pragma HLS INTERFACE ap_ctrl_none port=return
+#pragma HLS INTERFACE s_axilite port=thresUp
+#pragma HLS INTERFACE s_axilite port=target
+#pragma HLS INTERFACE s_axilite port=rows
+#pragma HLS INTERFACE s_axilite port=cols
+#pragma HLS INTERFACE s_axilite port=smoothShift
+#pragma HLS INTERFACE s_axilite port=reset
+#pragma HLS INTERFACE axis port=Stream_IN
+#pragma HLS INTERFACE axis port=Stream_OUT
+
+	rows = clampSize(rows, MAX_HEIGHT);
+	cols = clampSize(cols, MAX_WIDTH);
+
+#pragma HLS DATAFLOW
+	static thresholdState state = { 0, false, 0 };
+	RGB_IMAGE 	img1(rows,cols);
+
+	hls::AXIvideo2Mat(Stream_IN, img1);
+	harrisAdaptive<MAX_WIDTH,MAX_HEIGHT>(img1,Stream_OUT,thresUp,state,smoothShift,rows,cols,target,reset);
+}
+
+/*
+ * Multi-scale Harris corner detection, the corners of PYRAMID_LEVELS octaves
+ * in one sparse list. Every level is thresholded with its maximum of the
+ * frame before, the first frame gives an empty list.
+ */
+void harris_pyramid_top(AXI_STREAM &Stream_IN,cornerRecord *Corners_OUT,int thresUp,uint16_t &count,int rows,int cols){
+#pragma HLS INTERFACE ap_ctrl_none port=return
+#pragma HLS INTERFACE s_axilite port=thresUp
+#pragma HLS INTERFACE s_axilite port=count
+#pragma HLS INTERFACE s_axilite port=rows
+#pragma HLS INTERFACE s_axilite port=cols
+#pragma HLS INTERFACE axis port=Stream_IN
+#pragma HLS INTERFACE axis port=Corners_OUT
+
+	rows = clampSize(rows, MAX_HEIGHT);
+	cols = clampSize(cols, MAX_WIDTH);
+
+	RGB_IMAGE 	img1(rows,cols);
+
+	hls::AXIvideo2Mat(Stream_IN, img1);
+	harrisPyramid<MAX_WIDTH,MAX_HEIGHT,PYRAMID_LEVELS,MAX_CORNERS>(img1,Corners_OUT,count,thresUp,rows,cols);
+}
+
+/*
+ * Harris corner detection with HARRIS_PPC pixels per clock, the input
+ * carries one pixel per 32 bits of every beat. Frames are up to
+ * PPC_MAX_WIDTH x PPC_MAX_HEIGHT. The cols register is rounded down to a
+ * multiple of HARRIS_PPC, so every row has to be sent as that many pixels
+ * and the output rows have that width.
+ */
+void harris_ppc_top(AXI_WIDE_STREAM &Stream_IN,pixelPack<weightPixel,HARRIS_PPC> *Stream_OUT,int thresUp,int rows,int cols){
+#pragma HLS INTERFACE ap_ctrl_none port=return
+#pragma HLS INTERFACE s_axilite port=thresUp
+#pragma HLS INTERFACE s_axilite port=rows
+#pragma HLS INTERFACE s_axilite port=cols
+#pragma HLS INTERFACE axis port=Stream_IN
+#pragma HLS INTERFACE axis port=Stream_OUT
+
+	rows = clampSize(rows, PPC_MAX_HEIGHT);
+	cols = clampSize(cols / HARRIS_PPC, PPC_MAX_WIDTH / HARRIS_PPC) * HARRIS_PPC;
+
+	harrisPPC<PPC_MAX_WIDTH,PPC_MAX_HEIGHT,HARRIS_PPC>(Stream_IN,Stream_OUT,thresUp,rows,cols);
+}
+
+/*
+ * Harris corner detection for MULTI_STREAMS cameras in one instance. The
+ * rows of the cameras arrive interleaved on Stream_IN, tagged with TID.
+ * Every call handles rows rows of each camera.
+ */
+void harris_multi_top(AXI_TAGGED_STREAM &Stream_IN,taggedPixel *Stream_OUT,int thresUp[MULTI_STREAMS],int smoothShift,int rows,int cols){
+#pragma HLS INTERFACE ap_ctrl_none port=return
+#pragma HLS INTERFACE s_axilite port=thresUp
+#pragma HLS INTERFACE s_axilite port=smoothShift
+#pragma HLS INTERFACE s_axilite port=rows
+#pragma HLS INTERFACE s_axilite port=cols
+#pragma HLS INTERFACE axis port=Stream_IN
+#pragma HLS INTERFACE axis port=Stream_OUT
+
+	rows = clampSize(rows, MAX_HEIGHT);
+	cols = clampSize(cols, MAX_WIDTH);
+
+	harrisMultiStream<MAX_WIDTH,MAX_HEIGHT,MULTI_STREAMS>(Stream_IN,Stream_OUT,thresUp,smoothShift,rows*MULTI_STREAMS,rows,cols);
+}
+
+/*
+ * Harris corners and Canny edges from one read of the input stream
+ */
+void harris_canny_top(AXI_STREAM &Stream_IN,weightPixel *Corners_OUT,uint8_t *Edges_OUT,int thresUp,int low,int high,int rows,int cols){
+#pragma HLS INTERFACE ap_ctrl_none port=return
+#pragma HLS INTERFACE s_axilite port=thresUp
+#pragma HLS INTERFACE s_axilite port=low
+#pragma HLS INTERFACE s_axilite port=high
+#pragma HLS INTERFACE s_axilite port=rows
+#pragma HLS INTERFACE s_axilite port=cols
+#pragma HLS INTERFACE axis port=Stream_IN
+#pragma HLS INTERFACE axis port=Corners_OUT
+#pragma HLS INTERFACE axis port=Edges_OUT
+
+	rows = clampSize(rows, MAX_HEIGHT);
+	cols = clampSize(cols, MAX_WIDTH);
+
+#pragma HLS DATAFLOW
+	RGB_IMAGE 	img1(rows,cols);
+
+	hls::AXIvideo2Mat(Stream_IN, img1);
+	harrisCanny<MAX_WIDTH,MAX_HEIGHT>(img1,Corners_OUT,Edges_OUT,thresUp,low,high,rows,cols);
+}
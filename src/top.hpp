@@ -1,5 +1,15 @@
 #include "../src/harris.hpp"
+#include "../src/harris_ppc.hpp"
 
 using namespace imgProc;
 
-void harris_top(AXI_STREAM &Stream_IN,weightPixel *Stream_OUT,int thresUp);
+void harris_top(AXI_STREAM &Stream_IN,weightPixel *Stream_OUT,int thresUp,int rows,int cols,harrisStatus &status,volatile uint32_t &pixelsIn,volatile uint32_t &pixelsOut);
+void harris_raw_top(AXI_STREAM &Stream_IN,weightPixel *Stream_OUT,int thresUp,int format,int rows,int cols,harrisStatus &status,volatile uint32_t &pixelsIn,volatile uint32_t &pixelsOut);
+void harris_sparse_top(AXI_STREAM &Stream_IN,cornerRecord *Corners_OUT,int thresUp,uint16_t &count,int rows,int cols);
+void harris_grid_top(AXI_STREAM &Stream_IN,cornerRecord *Corners_OUT,int thresUp,int gridCols,int gridRows,uint16_t &count,int rows,int cols);
+void harris_count_top(AXI_STREAM &Stream_IN,weightPixel *Stream_OUT,int target,int rows,int cols,harrisStatus &status,volatile uint32_t &pixelsIn,volatile uint32_t &pixelsOut);
+void harris_video_top(AXI_STREAM &Stream_IN,weightPixel *Stream_OUT,int thresUp,int target,int smoothShift,bool reset,int rows,int cols);
+void harris_pyramid_top(AXI_STREAM &Stream_IN,cornerRecord *Corners_OUT,int thresUp,uint16_t &count,int rows,int cols);
+void harris_ppc_top(AXI_WIDE_STREAM &Stream_IN,pixelPack<weightPixel,HARRIS_PPC> *Stream_OUT,int thresUp,int rows,int cols);
+void harris_multi_top(AXI_TAGGED_STREAM &Stream_IN,taggedPixel *Stream_OUT,int thresUp[MULTI_STREAMS],int smoothShift,int rows,int cols);
+void harris_canny_top(AXI_STREAM &Stream_IN,weightPixel *Corners_OUT,uint8_t *Edges_OUT,int thresUp,int low,int high,int rows,int cols);
@@ -0,0 +1,382 @@
+#include "../src/top.hpp"
+#include "../src/harris_dataflow.hpp"
+#include "../src/harris_engine.hpp"
+#include "../src/harris_incremental.hpp"
+#include <hls_opencv.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#ifndef _WIN32
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+/*
+ * Benchmark of harris_top, canny, the threaded dataflow runtime, the
+ * asynchronous HarrisEngine and IncrementalHarris over Test_pictures and
+ * synthetic frames.
+ *
+ * bench [repeats] [baseline.csv] [tolerance in %]
+ *
+ * Every case runs once to warm up and then repeats times, the median frame
+ * time is reported. Results are written to bench_results.csv and compared
+ * against the baseline: a case whose ns/pixel grew by more than tolerance
+ * fails the run. The engine keeps its queue full, its frame time is the
+ * throughput and latency the median time from submit to delivery.
+ * IncrementalHarris sees the picture with a block that moves on every
+ * frame, like a fixed camera would.
+ *
+ * process_peak_kb is the peak resident memory of the whole process so far,
+ * it only grows from case to case. rss_growth_kb is the change of the
+ * resident memory over the case, mostly buffers it touched for the first
+ * time, negative when it gave back more than it kept.
+ *
+ * No baseline is committed, timings depend on the machine. Without a
+ * baseline file the first run records one and passes. Build with
+ * -DHARRIS_STATS to get the per stage times of harris and canny; canny
+ * fills gray, gauss and the edge stage columns.
+ */
+
+const int THRES_UP = 150;
+const int CANNY_LOW = 25;
+const int CANNY_HIGH = 50;
+
+struct benchCase {
+	std::string name;
+	cv::Mat image;
+};
+
+struct benchResult {
+	std::string name;
+	std::string kernel;
+	std::string status;
+	int width;
+	int height;
+	double fps;
+	double nsPerPixel;
+	uint32_t corners;
+	long peakKb;
+	long rssGrowthKb;
+	double latencyMs;
+	double stageNs[STAGE_COUNT];
+};
+
+/* Peak resident memory of the process, never drops between cases */
+static long peakMemoryKb() {
+#ifdef _WIN32
+	return 0;
+#else
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+#endif
+}
+
+/* Current resident memory, 0 without /proc */
+static long residentKb() {
+#ifdef _WIN32
+	return 0;
+#else
+	std::ifstream statm("/proc/self/statm");
+	long size, resident;
+	if (!(statm >> size >> resident))
+		return 0;
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+#endif
+}
+
+/* Blocks of random size and brightness plus noise, the same on every run */
+static cv::Mat syntheticFrame(int width, int height) {
+	cv::Mat image(height, width, CV_8UC3);
+	uint32_t seed = 12345;
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			seed = seed * 1103515245 + 12345;
+			int block = ((x / 37) * 7 + (y / 23) * 13) % 5;
+			int v = block * 50 + ((seed >> 16) & 15);
+			image.at<cv::Vec3b>(y, x) = cv::Vec3b(v, (v * 3) & 255, 255 - v);
+		}
+	}
+	return image;
+}
+
+static std::vector<benchCase> loadCases() {
+	const char *dirs[] = { "Test_pictures", "Test_pictures/range1",
+			"Test_pictures/range2", "Test_pictures/range3" };
+	std::vector<benchCase> cases;
+	for (int d = 0; d < 4; d++) {
+		std::vector<cv::String> files;
+		cv::glob(std::string(dirs[d]) + "/*.jpg", files, false);
+		std::sort(files.begin(), files.end());
+		for (size_t i = 0; i < files.size(); i++) {
+			benchCase c;
+			c.name = files[i];
+			c.image = cv::imread(files[i]);
+			if (!c.image.empty())
+				cases.push_back(c);
+		}
+	}
+	const int sizes[3][2] = { { 1280, 720 }, { 1920, 1080 }, { 3840, 2160 } };
+	for (int i = 0; i < 3; i++) {
+		benchCase c;
+		std::ostringstream name;
+		name << "synthetic_" << sizes[i][1] << "p";
+		c.name = name.str();
+		c.image = syntheticFrame(sizes[i][0], sizes[i][1]);
+		cases.push_back(c);
+	}
+	return cases;
+}
+
+static double median(std::vector<double> v) {
+	std::sort(v.begin(), v.end());
+	return v[v.size() / 2];
+}
+
+static void finish(benchResult &r, std::vector<double> &times) {
+	double ns = median(times);
+	r.status = "ok";
+	r.fps = 1e9 / ns;
+	r.nsPerPixel = ns / (r.width * r.height);
+	r.peakKb = peakMemoryKb();
+}
+
+static void benchHarris(benchCase &c, int repeats, benchResult &r) {
+	static weightPixel dense[MAX_WIDTH * MAX_HEIGHT];
+	std::vector<double> times;
+	harrisStatus status;
+	uint32_t pixelsIn, pixelsOut;
+	IplImage ipl = c.image;
+
+	for (int i = 0; i <= repeats; i++) {
+		AXI_STREAM stream;
+		IplImage2AXIvideo(&ipl, stream);
+#ifdef HARRIS_STATS
+		if (i == 1)
+			resetStatistics();
+#endif
+		std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+		harris_top(stream, dense, THRES_UP, r.height, r.width, status, pixelsIn, pixelsOut);
+		std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+		if (i > 0)
+			times.push_back(std::chrono::duration<double, std::nano>(end - begin).count());
+	}
+	finish(r, times);
+	r.corners = status.corners;
+#ifdef HARRIS_STATS
+	for (int s = 0; s < STAGE_COUNT; s++)
+		r.stageNs[s] = (double) statistics().stage[s].ns / repeats;
+#endif
+}
+
+static void benchCanny(benchCase &c, int repeats, benchResult &r) {
+	std::vector<double> times;
+	IplImage ipl = c.image;
+	IplImage *out = cvCreateImage(cvSize(r.width, r.height), IPL_DEPTH_8U, 3);
+
+	for (int i = 0; i <= repeats; i++) {
+		RGB_IMAGE src(r.height, r.width);
+		RGB_IMAGE dst(r.height, r.width);
+		IplImage2hlsMat(&ipl, src);
+#ifdef HARRIS_STATS
+		if (i == 1)
+			resetStatistics();
+#endif
+		std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+		canny<MAX_WIDTH,MAX_HEIGHT>(src, dst, CANNY_LOW, CANNY_HIGH, r.height, r.width);
+		std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+		hlsMat2IplImage(dst, out);
+		if (i > 0)
+			times.push_back(std::chrono::duration<double, std::nano>(end - begin).count());
+	}
+	finish(r, times);
+	cvReleaseImage(&out);
+#ifdef HARRIS_STATS
+	for (int s = 0; s < STAGE_COUNT; s++)
+		r.stageNs[s] = (double) statistics().stage[s].ns / repeats;
+#endif
+}
+
+static void benchDataflow(benchCase &c, int repeats, benchResult &r) {
+	static weightPixel dense[MAX_WIDTH * MAX_HEIGHT];
+	std::vector<double> times;
+	IplImage ipl = c.image;
+
+	for (int i = 0; i <= repeats; i++) {
+		RGB_IMAGE src(r.height, r.width);
+		IplImage2hlsMat(&ipl, src);
+		std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+		dataflow::harris<MAX_WIDTH,MAX_HEIGHT>(src, dense, THRES_UP, r.height, r.width);
+		std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+		if (i > 0)
+			times.push_back(std::chrono::duration<double, std::nano>(end - begin).count());
+	}
+	finish(r, times);
+	for (int i = 0; i < r.width * r.height; i++)
+		if (dense[i].t() == corner)
+			r.corners++;
+}
+
+static void benchEngine(benchCase &c, int repeats, benchResult &r) {
+	static HarrisEngine<MAX_WIDTH,MAX_HEIGHT> engine(THRES_UP);
+	std::vector<uint8_t> pixels(c.image.data, c.image.data + r.width * r.height * 3);
+	hostFrame warmUp = { pixels, r.height, r.width };
+	engine.submit(warmUp).get();
+
+	std::vector<std::future<harrisResult> > pending;
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	for (int i = 0; i < repeats; i++) {
+		hostFrame frame = { pixels, r.height, r.width };
+		pending.push_back(engine.submit(frame));
+	}
+	std::vector<double> latency;
+	for (int i = 0; i < repeats; i++) {
+		harrisResult result = pending[i].get();
+		latency.push_back(result.latency.total);
+		r.corners = result.status.corners;
+	}
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+	std::vector<double> times(1, std::chrono::duration<double, std::nano>(end - begin).count() / repeats);
+	finish(r, times);
+	r.latencyMs = median(latency) / 1e6;
+}
+
+static void benchIncremental(benchCase &c, int repeats, benchResult &r) {
+	static weightPixel dense[MAX_WIDTH * MAX_HEIGHT];
+	IncrementalHarris<MAX_WIDTH,MAX_HEIGHT> incremental;
+	std::vector<double> times;
+	const int size = std::min(64, std::min(r.width, r.height));
+
+	for (int i = 0; i <= repeats; i++) {
+		cv::Mat frame = c.image.clone();
+		int x0 = (i * 16) % (r.width - size + 1);
+		int y0 = (i * 16) % (r.height - size + 1);
+		for (int y = y0; y < y0 + size; y++) {
+			for (int x = x0; x < x0 + size; x++) {
+				cv::Vec3b &p = frame.at<cv::Vec3b>(y, x);
+				p = cv::Vec3b(255 - p[0], 255 - p[1], 255 - p[2]);
+			}
+		}
+		IplImage ipl = frame;
+		RGB_IMAGE src(r.height, r.width);
+		IplImage2hlsMat(&ipl, src);
+		std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+		incremental.run(src, dense, THRES_UP, r.height, r.width);
+		std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+		if (i > 0)
+			times.push_back(std::chrono::duration<double, std::nano>(end - begin).count());
+	}
+	finish(r, times);
+	for (int i = 0; i < r.width * r.height; i++)
+		if (dense[i].t() == corner)
+			r.corners++;
+}
+
+static void writeResults(const char *path, std::vector<benchResult> &results) {
+	std::ofstream csv(path);
+	csv << "name,kernel,status,width,height,fps,ns_per_pixel,corners,process_peak_kb,rss_growth_kb,latency_ms";
+	for (int s = 0; s < STAGE_COUNT; s++)
+		csv << "," << stageName(s) << "_ns";
+	csv << "\n";
+	for (size_t i = 0; i < results.size(); i++) {
+		benchResult &r = results[i];
+		csv << r.name << "," << r.kernel << "," << r.status << "," << r.width
+				<< "," << r.height << "," << r.fps << "," << r.nsPerPixel << ","
+				<< r.corners << "," << r.peakKb << "," << r.rssGrowthKb << "," << r.latencyMs;
+		for (int s = 0; s < STAGE_COUNT; s++)
+			csv << "," << r.stageNs[s];
+		csv << "\n";
+	}
+}
+
+/* ns/pixel of every case in a results file, keyed by name and kernel */
+static bool readBaseline(const char *path, std::map<std::string, double> &baseline) {
+	std::ifstream csv(path);
+	std::string line;
+	if (!std::getline(csv, line))
+		return false;
+	while (std::getline(csv, line)) {
+		std::vector<std::string> field;
+		std::istringstream row(line);
+		std::string f;
+		while (std::getline(row, f, ','))
+			field.push_back(f);
+		if (field.size() > 6 && field[2] == "ok")
+			baseline[field[0] + "," + field[1]] = atof(field[6].c_str());
+	}
+	return true;
+}
+
+int main(int argc, char *argv[]) {
+	int repeats = argc > 1 ? atoi(argv[1]) : 5;
+	const char *baselinePath = argc > 2 ? argv[2] : "bench_baseline.csv";
+	double tolerance = argc > 3 ? atof(argv[3]) : 10;
+	if (repeats < 1)
+		repeats = 1;
+
+	std::vector<benchCase> cases = loadCases();
+	std::vector<benchResult> results;
+	const char *kernels[] = { "harris", "canny", "dataflow", "engine", "incremental" };
+
+	for (size_t i = 0; i < cases.size(); i++) {
+		for (int k = 0; k < 5; k++) {
+			benchResult r = benchResult();
+			r.name = cases[i].name;
+			r.kernel = kernels[k];
+			r.width = cases[i].image.cols;
+			r.height = cases[i].image.rows;
+			long resident = residentKb();
+			if (r.width > MAX_WIDTH || r.height > MAX_HEIGHT) {
+				r.status = "skipped";
+			} else if (k == 0) {
+				benchHarris(cases[i], repeats, r);
+			} else if (k == 1) {
+				benchCanny(cases[i], repeats, r);
+			} else if (k == 2) {
+				benchDataflow(cases[i], repeats, r);
+			} else if (k == 3) {
+				benchEngine(cases[i], repeats, r);
+			} else {
+				benchIncremental(cases[i], repeats, r);
+			}
+			r.rssGrowthKb = residentKb() - resident;
+			printf("%-32s %-11s %5dx%-5d %-7s %8.2f fps %7.2f ns/px %6u corners\n",
+					r.name.c_str(), r.kernel.c_str(), r.width, r.height,
+					r.status.c_str(), r.fps, r.nsPerPixel, r.corners);
+			results.push_back(r);
+		}
+	}
+	writeResults("bench_results.csv", results);
+
+	std::map<std::string, double> baseline;
+	if (!readBaseline(baselinePath, baseline)) {
+		writeResults(baselinePath, results);
+		printf("No baseline found, recorded %s\n", baselinePath);
+		return 0;
+	}
+
+	int slower = 0;
+	for (size_t i = 0; i < results.size(); i++) {
+		benchResult &r = results[i];
+		std::map<std::string, double>::iterator b = baseline.find(r.name + "," + r.kernel);
+		if (r.status != "ok" || b == baseline.end())
+			continue;
+		double change = (r.nsPerPixel / b->second - 1) * 100;
+		if (change > tolerance) {
+			printf("SLOWER %s %s: %.2f -> %.2f ns/px (%+.1f%%)\n", r.name.c_str(),
+					r.kernel.c_str(), b->second, r.nsPerPixel, change);
+			slower++;
+		} else if (change < -tolerance) {
+			printf("faster %s %s: %.2f -> %.2f ns/px (%+.1f%%)\n", r.name.c_str(),
+					r.kernel.c_str(), b->second, r.nsPerPixel, change);
+		}
+	}
+	printf("%d of %d cases slower than the baseline\n", slower, (int) results.size());
+	return slower != 0;
+}
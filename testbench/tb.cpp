@@ -1,31 +1,94 @@
 #include "../src/top.hpp"
+#include "../src/harris_parallel.hpp"
+#include "../src/harris_dataflow.hpp"
+#include "../src/harris_engine.hpp"
+#include "../src/harris_incremental.hpp"
 #include <cstdlib>
 #include <hls_opencv.h>
 
+/*
+ * Forwards the first width pixels of every row, the rest of the row is
+ * dropped
+ */
+static void cropStream(AXI_STREAM &in, AXI_STREAM &out, int rows, int cols, int width) {
+	for (int y = 0; y < rows; y++) {
+		for (int x = 0; x < cols; x++) {
+			ap_axiu<32,1,1,1> px = in.read();
+			px.last = x == width - 1;
+			if (x < width)
+				out.write(px);
+		}
+	}
+}
+
+/*
+ * Frame f of camera c in the multi-stream case: the picture, mirrored if c
+ * is odd and at half the brightness if f is odd
+ */
+static uint32_t cameraPixel(const uint32_t *picture, int c, int f, int x, int y, int cols) {
+	uint32_t word = picture[(c % 2 ? cols - 1 - x : x) + y * cols];
+	return f % 2 ? (word >> 1) & 0x7F7F7F : word;
+}
+
+/* The picture as words of a 32 bit AXI stream into an RGB_IMAGE */
+static void pictureToMat(const uint32_t *picture, RGB_IMAGE &img, int n) {
+	for (int i = 0; i < n; i++) {
+		hls::Scalar<3,uint8_t> rgb;
+		for (int k = 0; k < 3; k++)
+			rgb.val[k] = picture[i] >> (8 * k);
+		img << rgb;
+	}
+}
+
+static bool sameFrame(const weightPixel *a, const weightPixel *b, int n) {
+	for (int i = 0; i < n; i++)
+		if (a[i].t() != b[i].t() || a[i].value() != b[i].value())
+			return false;
+	return true;
+}
+
 int main(int argc, char *argv[]) {
 	int thresUp = atoi(argv[1]);
 	IplImage* src_image = new IplImage;
 	IplImage* dst_image = new IplImage;
 	AXI_STREAM src_stream, out_stream;
-	src_image = cvLoadImage("Testpictures\\test.jpg");
+	src_image = cvLoadImage("Test_pictures/test.jpg");
 	dst_image = cvCreateImage(cvSize(MAX_WIDTH, MAX_HEIGHT), src_image->depth,
 			3);
+	int rows = src_image->height;
+	int cols = src_image->width;
 	IplImage2AXIvideo(src_image, src_stream);
 	static weightPixel harris[MAX_WIDTH * MAX_HEIGHT];
-	harris_top(src_stream, harris, thresUp);
-	cv::Mat image = cv::imread("test.jpg");
+	harrisStatus status;
+	uint32_t pixelsIn, pixelsOut;
+	harris_top(src_stream, harris, thresUp, rows, cols, status, pixelsIn, pixelsOut);
+	cv::Mat image = cv::imread("Test_pictures/test.jpg");
+
+	AXI_STREAM canny_stream;
+	static weightPixel combined[MAX_WIDTH * MAX_HEIGHT];
+	static uint8_t edges[MAX_WIDTH * MAX_HEIGHT];
+	IplImage2AXIvideo(src_image, canny_stream);
+	harris_canny_top(canny_stream, combined, edges, thresUp, 25, 50, rows, cols);
 
 	int corn = 0;
 	int edg = 0;
+	for (int i = 0; i < rows * cols; i++) {
+		if (combined[i].t() != harris[i].t() || combined[i].value() != harris[i].value()) {
+			std::cout << "Pixel " << i << " of the combined pipeline differs\n";
+			return 1;
+		}
+		if (edges[i])
+			edg++;
+	}
 	for (int y = 0; y < image.rows; y++) {
 		for (int x = 0; x < image.cols; x++) {
-			if (harris[x + y * MAX_WIDTH].t == corner) {
+			if (harris[x + y * cols].t() == corner) {
 				cv::Vec3b pixel2;
 				pixel2.val[0] = 0;
 				pixel2.val[1] = 255;
 				pixel2.val[2] = 0;
 
-				if (y > 5 && y < MAX_HEIGHT - 5 && x > 5 && x < MAX_WIDTH) {
+				if (y > 5 && y < rows - 5 && x > 5 && x < cols) {
 					image.at<cv::Vec3b>(y + 0-2, x-2) = pixel2;
 					image.at<cv::Vec3b>(y - 1-2, x-2) = pixel2;
 					image.at<cv::Vec3b>(y + 1-2, x-2) = pixel2;
@@ -46,6 +109,396 @@ int main(int argc, char *argv[]) {
 	}
 	std::cout << "Corner " << corn << "\n";
 	std::cout << "Edge " << edg << "\n";
+	std::cout << "Status frames " << status.frames << " pixels " << status.pixels
+			<< " corners " << status.corners << " peak " << status.peak << "\n";
+	if (status.pixels != (uint32_t) (rows * cols)) {
+		std::cout << "Status does not cover the frame\n";
+		return 1;
+	}
+	if (pixelsIn != (uint32_t) (rows * cols) || pixelsOut != (uint32_t) (rows * cols)) {
+		std::cout << "Progress counters stop at " << pixelsIn << " and " << pixelsOut << "\n";
+		return 1;
+	}
+#ifdef HARRIS_STATS
+	for (int i = 0; i < STAGE_COUNT; i++) {
+		stageStats &s = statistics().stage[i];
+		std::cout << stageName(i) << " " << s.ns << " ns " << s.pixelsIn
+				<< " in " << s.pixelsOut << " out\n";
+	}
+#endif
+
+	int total = 0;
+	for (int i = 0; i < rows * cols; i++) {
+		if (harris[i].t() == corner)
+			total++;
+	}
+	AXI_STREAM sparse_stream;
+	static cornerRecord list[MAX_CORNERS + 1];
+	uint16_t count = 0;
+	IplImage2AXIvideo(src_image, sparse_stream);
+	harris_sparse_top(sparse_stream, list, thresUp, count, rows, cols);
+	int expected = total < MAX_CORNERS ? total : MAX_CORNERS;
+	std::cout << "Sparse corners " << count << "\n";
+	if (count != expected || !list[count].last) {
+		std::cout << "Sparse list does not match the dense frame\n";
+		return 1;
+	}
+	for (int i = 0; i < count; i++) {
+		weightPixel px = harris[list[i].x + list[i].y * cols];
+		if (px.t() != corner || px.value() != list[i].score
+				|| (i > 0 && list[i].score > list[i - 1].score)) {
+			std::cout << "Sparse record " << i << " is wrong\n";
+			return 1;
+		}
+	}
+	AXI_STREAM grid_stream;
+	static cornerRecord cells[GRID_COLS * GRID_ROWS * GRID_CORNERS + 1];
+	uint16_t cellCount = 0;
+	IplImage2AXIvideo(src_image, grid_stream);
+	harris_grid_top(grid_stream, cells, thresUp, GRID_COLS, GRID_ROWS, cellCount, rows, cols);
+	int cellWidth = (cols + GRID_COLS - 1) / GRID_COLS;
+	int cellHeight = (rows + GRID_ROWS - 1) / GRID_ROWS;
+	int perCell[GRID_COLS * GRID_ROWS] = { 0 };
+	int cellExpected = 0;
+	for (int i = 0; i < rows * cols; i++)
+		if (harris[i].t() == corner)
+			perCell[(i % cols) / cellWidth + (i / cols) / cellHeight * GRID_COLS]++;
+	for (int c = 0; c < GRID_COLS * GRID_ROWS; c++)
+		cellExpected += perCell[c] < GRID_CORNERS ? perCell[c] : GRID_CORNERS;
+	std::cout << "Grid corners " << cellCount << "\n";
+	if (cellCount != cellExpected || !cells[cellCount].last) {
+		std::cout << "Grid list does not match the dense frame\n";
+		return 1;
+	}
+	for (int i = 0; i < cellCount; i++) {
+		weightPixel px = harris[cells[i].x + cells[i].y * cols];
+		if (px.t() != corner || px.value() != cells[i].score) {
+			std::cout << "Grid record " << i << " is wrong\n";
+			return 1;
+		}
+	}
+	const int ppcCols = cols - cols % HARRIS_PPC;
+	AXI_STREAM narrow_stream, crop_stream, ref_stream;
+	AXI_WIDE_STREAM wide_stream;
+	static pixelPack<weightPixel,HARRIS_PPC> packed[PPC_MAX_WIDTH * PPC_MAX_HEIGHT / HARRIS_PPC];
+	static weightPixel cropped[MAX_WIDTH * MAX_HEIGHT];
+	harrisStatus cropStatus;
+	IplImage2AXIvideo(src_image, narrow_stream);
+	cropStream(narrow_stream, crop_stream, rows, cols, ppcCols);
+	harris_top(crop_stream, cropped, thresUp, rows, ppcCols, cropStatus, pixelsIn, pixelsOut);
+	IplImage2AXIvideo(src_image, narrow_stream);
+	cropStream(narrow_stream, ref_stream, rows, cols, ppcCols);
+	for (int i = 0; i < rows * ppcCols / HARRIS_PPC; i++) {
+		ap_axiu<32*HARRIS_PPC,1,1,1> beat;
+		for (int j = 0; j < HARRIS_PPC; j++) {
+			ap_axiu<32,1,1,1> px = ref_stream.read();
+			beat.data.range(32 * j + 31, 32 * j) = px.data;
+			if (j == 0)
+				beat.user = px.user;
+			beat.last = px.last;
+		}
+		wide_stream.write(beat);
+	}
+	harris_ppc_top(wide_stream, packed, thresUp, rows, cols);
+	for (int i = 0; i < rows * ppcCols; i++) {
+		weightPixel px = packed[i / HARRIS_PPC].px[i % HARRIS_PPC];
+		if (px.t() != cropped[i].t() || px.value() != cropped[i].value()) {
+			std::cout << "Pixel " << i << " of the PPC pipeline differs\n";
+			return 1;
+		}
+	}
+
+	AXI_STREAM rgb_stream, mono_stream;
+	static weightPixel luma[MAX_WIDTH * MAX_HEIGHT];
+	harrisStatus lumaStatus;
+	IplImage2AXIvideo(src_image, rgb_stream);
+	for (int y = 0; y < rows; y++) {
+		ap_axiu<32,1,1,1> beat;
+		uint32_t word = 0;
+		for (int x = 0; x < cols; x++) {
+			ap_axiu<32,1,1,1> px = rgb_stream.read();
+			hls::Scalar<3,uint8_t> rgb;
+			for (int c = 0; c < 3; c++)
+				rgb.val[c] = (uint32_t) px.data >> (8 * c);
+			word |= (uint32_t) grayPixel(rgb) << (8 * (x % 4));
+			if (x % 4 == 0)
+				beat.user = px.user;
+			if (x % 4 == 3 || x == cols - 1) {
+				beat.data = word;
+				beat.last = px.last;
+				mono_stream.write(beat);
+				word = 0;
+			}
+		}
+	}
+	harris_raw_top(mono_stream, luma, thresUp, rawMono, rows, cols, lumaStatus, pixelsIn, pixelsOut);
+	for (int i = 0; i < rows * cols; i++) {
+		if (luma[i].t() != harris[i].t() || luma[i].value() != harris[i].value()) {
+			std::cout << "Pixel " << i << " of the mono input differs\n";
+			return 1;
+		}
+	}
+
+	responseHistogram hist;
+	uint32_t responses = 0, widest = 0;
+	hist.clear();
+	for (int32_t R = 1; R < 1 << 24; R += R / 64 + 1)
+		hist.add(R);
+	for (int b = 0; b < HISTOGRAM_BINS; b++) {
+		responses += hist.bin[b];
+		widest = hist.bin[b] > widest ? hist.bin[b] : widest;
+	}
+	const uint32_t targets[4] = { 1, 100, 500, 100000 };
+	for (int t = 0; t < 4; t++) {
+		int32_t high = hist.threshold(targets[t]);
+		uint32_t passed = 0;
+		for (int32_t R = 1; R < 1 << 24; R += R / 64 + 1)
+			passed += R > high;
+		uint32_t reachable = targets[t] < responses ? targets[t] : responses;
+		if (passed > targets[t] || passed + widest <= reachable) {
+			std::cout << "Histogram threshold passes " << passed << " responses for a target of " << targets[t] << "\n";
+			return 1;
+		}
+	}
+
+	AXI_STREAM count_stream;
+	static weightPixel counted[MAX_WIDTH * MAX_HEIGHT];
+	harrisStatus countStatus;
+	const int target = 100;
+	IplImage2AXIvideo(src_image, count_stream);
+	harris_count_top(count_stream, counted, target, rows, cols, countStatus, pixelsIn, pixelsOut);
+	std::cout << "Corners for a target of " << target << " " << countStatus.corners << "\n";
+	/* the suppression forwards a candidate at most twice, see harris_count_top */
+	if (countStatus.corners == 0 || countStatus.corners > (uint32_t) (2 * target)) {
+		std::cout << "Corner count misses the target\n";
+		return 1;
+	}
+
+	AXI_STREAM pyramid_stream;
+	static cornerRecord scales[MAX_CORNERS + 1];
+	uint16_t scaleCount = 0;
+	int perLevel[PYRAMID_LEVELS] = { 0 };
+	IplImage2AXIvideo(src_image, pyramid_stream);
+	harris_pyramid_top(pyramid_stream, scales, thresUp, scaleCount, rows, cols);
+	if (scaleCount != 0) {
+		std::cout << "Pyramid reports corners on its first frame\n";
+		return 1;
+	}
+	IplImage2AXIvideo(src_image, pyramid_stream);
+	harris_pyramid_top(pyramid_stream, scales, thresUp, scaleCount, rows, cols);
+	for (int i = 0; i < scaleCount; i++)
+		perLevel[scales[i].level]++;
+	for (int l = 0; l < PYRAMID_LEVELS; l++)
+		std::cout << "Level " << l << " corners " << perLevel[l] << "\n";
+	if (!scales[scaleCount].last) {
+		std::cout << "Pyramid list is not terminated\n";
+		return 1;
+	}
+	AXI_STREAM video_stream, adaptive_stream;
+	static weightPixel video[MAX_WIDTH * MAX_HEIGHT];
+	static weightPixel adaptive[MAX_WIDTH * MAX_HEIGHT];
+	thresholdState adaptiveState = { 0, false, 0 };
+	for (int frame = 0; frame < 2; frame++) {
+		IplImage2AXIvideo(src_image, video_stream);
+		harris_video_top(video_stream, video, thresUp, 0, 0, frame == 0, rows, cols);
+		RGB_IMAGE adaptiveImage(rows, cols);
+		IplImage2AXIvideo(src_image, adaptive_stream);
+		hls::AXIvideo2Mat(adaptive_stream, adaptiveImage);
+		bool searched = harrisAdaptive<MAX_WIDTH,MAX_HEIGHT>(adaptiveImage, adaptive, thresUp, adaptiveState, 0, rows, cols);
+		if (searched != (frame == 1)) {
+			std::cout << "harrisAdaptive searched frame " << frame << " wrongly\n";
+			return 1;
+		}
+		for (int i = 0; i < rows * cols; i++) {
+			bool wrong = frame == 0 ? video[i].t() == corner || adaptive[i].t() == corner
+					: video[i].t() != harris[i].t() || video[i].value() != harris[i].value()
+					|| adaptive[i].t() != harris[i].t() || adaptive[i].value() != harris[i].value();
+			if (wrong) {
+				std::cout << "Pixel " << i << " of video frame " << frame << " differs\n";
+				return 1;
+			}
+		}
+	}
+
+	/*
+	 * Rows of all cameras round robin over three calls, each camera with its
+	 * own thresUp. Camera 0 drops its first frame halfway with a new start
+	 * of frame, so its frames also straddle the calls. Every completed frame
+	 * has to match harrisAdaptive on that camera alone.
+	 */
+	AXI_STREAM picture_stream;
+	static uint32_t picture[MAX_WIDTH * MAX_HEIGHT];
+	static taggedPixel multi[MULTI_STREAMS * MAX_WIDTH * MAX_HEIGHT];
+	static weightPixel cameraFrame[MULTI_STREAMS][MAX_WIDTH * MAX_HEIGHT];
+	static weightPixel cameraExpected[MAX_WIDTH * MAX_HEIGHT];
+	static int callY[MULTI_STREAMS * MAX_HEIGHT];
+	static int callFrame[MULTI_STREAMS * MAX_HEIGHT];
+	static bool callEnd[MULTI_STREAMS * MAX_HEIGHT];
+	int multiThres[MULTI_STREAMS];
+	int frameY[MULTI_STREAMS];
+	int frameNo[MULTI_STREAMS];
+	thresholdState multiState[MULTI_STREAMS];
+	bool aborted = false;
+	int multiFrames = 0;
+	IplImage2AXIvideo(src_image, picture_stream);
+	for (int i = 0; i < rows * cols; i++)
+		picture[i] = picture_stream.read().data;
+	for (int c = 0; c < MULTI_STREAMS; c++) {
+		multiThres[c] = thresUp + 1000 * c;
+		frameY[c] = 0;
+		frameNo[c] = 0;
+		multiState[c].max = 0;
+		multiState[c].valid = false;
+		multiState[c].high = 0;
+	}
+	for (int call = 0; call < 3; call++) {
+		AXI_TAGGED_STREAM tagged_stream;
+		for (int r = 0; r < rows * MULTI_STREAMS; r++) {
+			int c = r % MULTI_STREAMS;
+			int height = c == 0 && !aborted ? rows / 2 : rows;
+			for (int x = 0; x < cols; x++) {
+				ap_axiu<32,1,8,1> beat;
+				beat.data = cameraPixel(picture, c, frameNo[c], x, frameY[c], cols);
+				beat.user = x == 0 && frameY[c] == 0;
+				beat.id = c;
+				beat.last = x == cols - 1;
+				tagged_stream.write(beat);
+			}
+			callY[r] = frameY[c];
+			callFrame[r] = frameNo[c];
+			callEnd[r] = false;
+			if (++frameY[c] == height) {
+				frameY[c] = 0;
+				frameNo[c]++;
+				callEnd[r] = height == rows;
+				aborted = true;
+			}
+		}
+		harris_multi_top(tagged_stream, multi, multiThres, 1, rows, cols);
+		for (int r = 0; r < rows * MULTI_STREAMS; r++) {
+			int c = r % MULTI_STREAMS;
+			for (int x = 0; x < cols; x++) {
+				if (multi[x + r * cols].id != c) {
+					std::cout << "Row " << r << " of multi-stream call " << call << " has the wrong camera\n";
+					return 1;
+				}
+				cameraFrame[c][x + callY[r] * cols] = multi[x + r * cols].pixel;
+			}
+			if (!callEnd[r])
+				continue;
+			RGB_IMAGE cameraImage(rows, cols);
+			for (int i = 0; i < rows * cols; i++) {
+				uint32_t word = cameraPixel(picture, c, callFrame[r], i % cols, i / cols, cols);
+				hls::Scalar<3,uint8_t> rgb;
+				for (int k = 0; k < 3; k++)
+					rgb.val[k] = word >> (8 * k);
+				cameraImage << rgb;
+			}
+			harrisAdaptive<MAX_WIDTH,MAX_HEIGHT>(cameraImage, cameraExpected, multiThres[c], multiState[c], 1, rows, cols);
+			for (int i = 0; i < rows * cols; i++) {
+				if (cameraFrame[c][i].t() != cameraExpected[i].t() || cameraFrame[c][i].value() != cameraExpected[i].value()) {
+					std::cout << "Pixel " << i << " of camera " << c << " differs from harrisAdaptive\n";
+					return 1;
+				}
+			}
+			multiFrames++;
+		}
+	}
+	std::cout << "Multi-stream frames " << multiFrames << "\n";
+
+	/* every software backend gives the dense frame of harris_top */
+	static weightPixel backend[MAX_WIDTH * MAX_HEIGHT];
+	RGB_IMAGE simdImage(rows, cols);
+	pictureToMat(picture, simdImage, rows * cols);
+	simd::harris<MAX_WIDTH,MAX_HEIGHT>(simdImage, backend, thresUp, rows, cols);
+	if (!sameFrame(backend, harris, rows * cols)) {
+		std::cout << "simd::harris differs\n";
+		return 1;
+	}
+	RGB_IMAGE parallelImage(rows, cols);
+	pictureToMat(picture, parallelImage, rows * cols);
+	parallel::harris<MAX_WIDTH,MAX_HEIGHT>(parallelImage, backend, thresUp, rows, cols);
+	if (!sameFrame(backend, harris, rows * cols)) {
+		std::cout << "parallel::harris differs\n";
+		return 1;
+	}
+	RGB_IMAGE dataflowImage(rows, cols);
+	pictureToMat(picture, dataflowImage, rows * cols);
+	dataflow::harris<MAX_WIDTH,MAX_HEIGHT>(dataflowImage, backend, thresUp, rows, cols);
+	if (!sameFrame(backend, harris, rows * cols)) {
+		std::cout << "dataflow::harris differs\n";
+		return 1;
+	}
+	static HarrisContext<MAX_WIDTH,MAX_HEIGHT> harrisContext;
+	RGB_IMAGE contextImage(rows, cols);
+	pictureToMat(picture, contextImage, rows * cols);
+	harrisContext.run(contextImage, backend, thresUp, rows, cols);
+	if (!sameFrame(backend, harris, rows * cols)) {
+		std::cout << "HarrisContext differs\n";
+		return 1;
+	}
+	IncrementalHarris<MAX_WIDTH,MAX_HEIGHT> incremental;
+	for (int frame = 0; frame < 2; frame++) {
+		RGB_IMAGE incrementalImage(rows, cols);
+		pictureToMat(picture, incrementalImage, rows * cols);
+		incremental.run(incrementalImage, backend, thresUp, rows, cols);
+		if (!sameFrame(backend, harris, rows * cols)) {
+			std::cout << "IncrementalHarris differs on frame " << frame << "\n";
+			return 1;
+		}
+	}
+
+	HarrisEngine<MAX_WIDTH,MAX_HEIGHT> engine(thresUp);
+	hostFrame hostPicture;
+	hostPicture.rows = rows;
+	hostPicture.cols = cols;
+	for (int i = 0; i < rows * cols; i++)
+		for (int k = 0; k < 3; k++)
+			hostPicture.pixels.push_back(picture[i] >> (8 * k));
+	harrisResult engineResult = engine.submit(hostPicture).get();
+	size_t engineCorners = 0;
+	for (int i = 0; i < rows * cols; i++) {
+		if (harris[i].t() != corner)
+			continue;
+		if (engineCorners >= engineResult.corners.size()
+				|| engineResult.corners[engineCorners].x != i % cols
+				|| engineResult.corners[engineCorners].y != i / cols
+				|| engineResult.corners[engineCorners].score != harris[i].value()) {
+			std::cout << "HarrisEngine corner " << engineCorners << " differs\n";
+			return 1;
+		}
+		engineCorners++;
+	}
+	if (engineResult.outcome != frameDone || engineCorners != engineResult.corners.size()) {
+		std::cout << "HarrisEngine corner list does not match the dense frame\n";
+		return 1;
+	}
+
+	RGB_IMAGE cannyIn(rows, cols), cannyOut(rows, cols);
+	RGB_IMAGE contextIn(rows, cols), contextOut(rows, cols);
+	RGB_IMAGE dataflowIn(rows, cols), dataflowOut(rows, cols);
+	static CannyContext<MAX_WIDTH,MAX_HEIGHT> cannyContext;
+	pictureToMat(picture, cannyIn, rows * cols);
+	pictureToMat(picture, contextIn, rows * cols);
+	pictureToMat(picture, dataflowIn, rows * cols);
+	canny<MAX_WIDTH,MAX_HEIGHT>(cannyIn, cannyOut, 25, 50, rows, cols);
+	cannyContext.run(contextIn, contextOut, 25, 50, rows, cols);
+	dataflow::canny<MAX_WIDTH,MAX_HEIGHT>(dataflowIn, dataflowOut, 25, 50, rows, cols);
+	for (int i = 0; i < rows * cols; i++) {
+		hls::Scalar<3,uint8_t> a, b, c;
+		cannyOut >> a;
+		contextOut >> b;
+		dataflowOut >> c;
+		if (a.val[0] != b.val[0] || a.val[1] != b.val[1] || a.val[2] != b.val[2]) {
+			std::cout << "Pixel " << i << " of CannyContext differs from canny\n";
+			return 1;
+		}
+		if (a.val[0] != c.val[0] || a.val[1] != c.val[1] || a.val[2] != c.val[2]) {
+			std::cout << "Pixel " << i << " of dataflow::canny differs from canny\n";
+			return 1;
+		}
+	}
+
 	cv::imwrite("result.jpg", image);
 	//AXIvideo2IplImage(out_stream,dst_image);
 	//cvSaveImage("move.jpg", dst_image);